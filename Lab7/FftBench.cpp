@@ -0,0 +1,58 @@
+#include "pch.h"
+#include "ImageManager.h"
+#include "FrequencyDomainManager.h"
+
+// Times a forward + inverse fft2d on square random planes from 256^2 up to
+// the size given on the command line (8192 by default) and prints the cost
+// per pixel. Plans are built before timing starts.
+//
+//     Lab7FftBench [max size] [threads]
+
+// Each size repeats until at least this much time has passed
+#define BENCH_MIN_SECONDS 1.0
+
+template<typename Real>
+static void bench(int size, const char* type) {
+    BasicFd<Real> fd{};
+    fd.width = size;
+    fd.height = size;
+    fd.spectrumWidth = size / 2 + 1;
+    std::vector<std::complex<Real>> bins(static_cast<size_t>(size) * fd.spectrumWidth);
+    fd.img = bins.data();
+    std::mt19937 rng(size);
+    for (auto& bin : bins) {
+        bin = std::complex<Real>(rng() % 256, rng() % 256);
+    }
+
+    const FftPlan<Real>& forward = FdSystem::getPlan<Real>(size, size, false);
+    const FftPlan<Real>& inverse = FdSystem::getPlan<Real>(size, size, true);
+    FdSystem::fft2d(fd, forward);
+    FdSystem::fft2d(fd, inverse);
+
+    int runs = 0;
+    double seconds = 0;
+    const auto start = std::chrono::steady_clock::now();
+    while (seconds < BENCH_MIN_SECONDS) {
+        FdSystem::fft2d(fd, forward);
+        FdSystem::fft2d(fd, inverse);
+        runs++;
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    const double pixels = static_cast<double>(size) * size;
+    std::printf("  %5d^2  %-6s %8.2f ms  %6.2f ns/px  (%d runs)\n", size, type, seconds * 1e3 / runs, seconds * 1e9 / runs / pixels, runs);
+}
+
+int main(int argc, char** argv) {
+    const int maxSize = argc > 1 ? std::atoi(argv[1]) : 8192;
+    if (argc > 2) {
+        FdSystem::setThreadCount(std::atoi(argv[2]));
+    }
+
+    std::printf("forward + inverse fft2d, %d worker(s)\n", FdSystem::getThreadCount());
+    for (int size = 256; size <= maxSize; size *= 2) {
+        bench<double>(size, "double");
+        bench<float>(size, "float");
+    }
+    return 0;
+}
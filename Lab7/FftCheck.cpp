@@ -0,0 +1,345 @@
+#include "pch.h"
+#include "ImageManager.h"
+#include "FrequencyDomainManager.h"
+
+// Checks FdSystem against direct evaluation, one section per transform
+// path. Exits non-zero when any case is off by more than its tolerance.
+
+// Worst error allowed relative to the largest reference value
+#define CHECK_TOLERANCE_DOUBLE 1e-9
+#define CHECK_TOLERANCE_FLOAT 1e-4
+
+static int failures = 0;
+
+static void report(const char* what, int width, int height, const char* type, double error, double tolerance) {
+    const bool ok = error <= tolerance;
+    failures += !ok;
+    std::printf("  %-10s %4d x %-4d %-6s error %.2e  %s\n", what, width, height, type, error, ok ? "ok" : "FAIL");
+}
+
+template<typename Real>
+static Real* samples(std::vector<std::complex<Real>>& bins, int spectrumWidth, int y) {
+    return reinterpret_cast<Real*>(&bins[static_cast<size_t>(y) * spectrumWidth]);
+}
+
+// Forward transform of a random real plane against the DFT sum, then the
+// inverse back to the plane
+template<typename Real>
+static void checkTransform(int width, int height, const char* type, double tolerance) {
+    std::mt19937 rng(width * 1000 + height);
+    std::vector<double> plane(static_cast<size_t>(width) * height);
+    for (double& value : plane) {
+        value = rng() % 256;
+    }
+
+    BasicFd<Real> fd{};
+    fd.width = width;
+    fd.height = height;
+    fd.spectrumWidth = width / 2 + 1;
+    std::vector<std::complex<Real>> bins(static_cast<size_t>(height) * fd.spectrumWidth);
+    fd.img = bins.data();
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            samples(bins, fd.spectrumWidth, y)[x] = static_cast<Real>(plane[y * width + x]);
+        }
+    }
+
+    FdSystem::fft2d(fd);
+
+    // X[v][u] = sum f[y][x] e^(2 pi i (ux / width + vy / height)) for the
+    // stored half u <= width / 2; the forward transform has always used the
+    // positive exponent, which conjugates the phase but not the magnitude
+    double forwardError = 0;
+    double peak = 0;
+    for (int v = 0; v < height; v++) {
+        for (int u = 0; u < fd.spectrumWidth; u++) {
+            std::complex<double> sum = 0;
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    const double angle = 2 * M_PI * (static_cast<double>(u * x % width) / width + static_cast<double>(v * y % height) / height);
+                    sum += plane[y * width + x] * std::polar(1.0, angle);
+                }
+            }
+            const std::complex<double> bin(bins[v * fd.spectrumWidth + u].real(), bins[v * fd.spectrumWidth + u].imag());
+            forwardError = std::max(forwardError, std::abs(bin - sum));
+            peak = std::max(peak, std::abs(sum));
+        }
+    }
+    report("fft2d", width, height, type, forwardError / peak, tolerance);
+
+    FdSystem::fft2d(fd, true);
+    double inverseError = 0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            inverseError = std::max(inverseError, std::abs(samples(bins, fd.spectrumWidth, y)[x] - plane[y * width + x]));
+        }
+    }
+    report("inverse", width, height, type, inverseError / 255, tolerance);
+}
+
+// A notch on the Nyquist row or column of a random plane, filtered through
+// the half spectrum, against the full spectrum filtered with the transfer
+// function mirrored from the stored half. The mirrored function has to be
+// Hermitian (the inverse comes out real), it has to reject the notch's own
+// bin and its mirror, and both results have to agree.
+static void checkNotch(int width, int height, int notchU, int notchV) {
+    const FilterSpec spec{FilterBand::NotchReject, FilterShape::Gaussian, 1.5, 0, 2, notchU, notchV};
+    std::mt19937 rng(width * 31 + height);
+    std::vector<double> plane(static_cast<size_t>(width) * height);
+    for (double& value : plane) {
+        value = rng() % 256;
+    }
+
+    Fd fd{};
+    fd.width = width;
+    fd.height = height;
+    fd.spectrumWidth = width / 2 + 1;
+    std::vector<std::complex<double>> bins(static_cast<size_t>(height) * fd.spectrumWidth);
+    fd.img = bins.data();
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            samples(bins, fd.spectrumWidth, y)[x] = plane[y * width + x];
+        }
+    }
+    FdSystem::fft2d(fd);
+    FdSystem::applyFilter(fd, spec);
+    FdSystem::fft2d(fd, true);
+
+    const auto transfer = FdSystem::getTransferFunction<double>(width, height, spec);
+    auto h = [&](int u, int v) {
+        u = (u % width + width) % width;
+        v = (v % height + height) % height;
+        return u < fd.spectrumWidth ? (*transfer)[v * fd.spectrumWidth + u] : (*transfer)[(height - v) % height * fd.spectrumWidth + width - u];
+    };
+
+    std::vector<std::complex<double>> spectrum(plane.size());
+    for (int v = 0; v < height; v++) {
+        for (int u = 0; u < width; u++) {
+            std::complex<double> sum = 0;
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    const double angle = 2 * M_PI * (static_cast<double>(u * x % width) / width + static_cast<double>(v * y % height) / height);
+                    sum += plane[y * width + x] * std::polar(1.0, angle);
+                }
+            }
+            spectrum[v * width + u] = sum * h(u, v);
+        }
+    }
+
+    double error = std::max(h(notchU, notchV), h(-notchU, -notchV));
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            std::complex<double> sum = 0;
+            for (int v = 0; v < height; v++) {
+                for (int u = 0; u < width; u++) {
+                    const double angle = -2 * M_PI * (static_cast<double>(u * x % width) / width + static_cast<double>(v * y % height) / height);
+                    sum += spectrum[v * width + u] * std::polar(1.0, angle);
+                }
+            }
+            sum /= static_cast<double>(width) * height;
+            error = std::max(error, std::abs(sum.imag()) / 255);
+            error = std::max(error, std::abs(sum.real() - samples(bins, fd.spectrumWidth, y)[x]) / 255);
+        }
+    }
+    report("notch", width, height, "double", error, CHECK_TOLERANCE_DOUBLE);
+}
+
+// convolve against the direct correlation it documents; pixels whose window
+// leaves the plane must be left as they were
+template<typename Real>
+static void checkConvolution(int width, int height, int kernelWidth, int kernelHeight, const char* type, double tolerance) {
+    std::mt19937 rng(width * 31 + kernelWidth);
+    std::uniform_real_distribution<double> weight(-1, 1);
+    std::vector<Real> src(static_cast<size_t>(width) * height);
+    std::vector<Real> kernel(static_cast<size_t>(kernelWidth) * kernelHeight);
+    for (Real& value : src) {
+        value = static_cast<Real>(rng() % 256);
+    }
+    for (Real& value : kernel) {
+        value = static_cast<Real>(weight(rng));
+    }
+
+    const Real untouched = -12345;
+    std::vector<Real> dst(src.size(), untouched);
+    FdSystem::convolve(src.data(), dst.data(), width, height, kernel.data(), kernelWidth, kernelHeight);
+
+    double error = 0;
+    double peak = 0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const int top = y - kernelHeight / 2;
+            const int left = x - kernelWidth / 2;
+            const Real result = dst[y * width + x];
+            if (top < 0 || left < 0 || top + kernelHeight > height || left + kernelWidth > width) {
+                error = std::max(error, result == untouched ? 0.0 : std::numeric_limits<double>::infinity());
+                continue;
+            }
+            double sum = 0;
+            for (int i = 0; i < kernelHeight; i++) {
+                for (int j = 0; j < kernelWidth; j++) {
+                    sum += static_cast<double>(src[(top + i) * width + left + j]) * kernel[i * kernelWidth + j];
+                }
+            }
+            error = std::max(error, std::abs(result - sum));
+            peak = std::max(peak, std::abs(sum));
+        }
+    }
+
+    char what[32];
+    std::snprintf(what, sizeof(what), "conv %dx%d", kernelWidth, kernelHeight);
+    report(what, width, height, type, error / std::max(peak, 1.0), tolerance);
+}
+
+// getPlan hands out one plan per (size, direction), and transforming
+// through it matches fft2d building its own
+template<typename Real>
+static void checkPlanCache(int width, int height, const char* type) {
+    const FftPlan<Real>& forward = FdSystem::getPlan<Real>(width, height, false);
+    const bool shared = &forward == &FdSystem::getPlan<Real>(width, height, false)
+                     && &forward != &FdSystem::getPlan<Real>(width, height, true)
+                     && &forward != &FdSystem::getPlan<Real>(height, width, false);
+
+    BasicFd<Real> fd{};
+    fd.width = width;
+    fd.height = height;
+    fd.spectrumWidth = width / 2 + 1;
+    std::vector<std::complex<Real>> bins(static_cast<size_t>(height) * fd.spectrumWidth);
+    std::mt19937 rng(width + height);
+    for (auto& bin : bins) {
+        bin = std::complex<Real>(rng() % 256, rng() % 256);
+    }
+    std::vector<std::complex<Real>> copy = bins;
+    fd.img = bins.data();
+    FdSystem::fft2d(fd, forward);
+    fd.img = copy.data();
+    FdSystem::fft2d(fd);
+
+    report("plan", width, height, type, shared && bins == copy ? 0 : 1, 0);
+}
+
+// The vectorised radix-2/4 butterflies against the scalar path, forward
+// and inverse. Only meaningful where isSimdActive() is true; elsewhere both
+// runs take the scalar path and agree trivially.
+template<typename Real>
+static void checkSimd(int width, int height, const char* type, double tolerance) {
+    BasicFd<Real> fd{};
+    fd.width = width;
+    fd.height = height;
+    fd.spectrumWidth = width / 2 + 1;
+    std::vector<std::complex<Real>> input(static_cast<size_t>(height) * fd.spectrumWidth);
+    std::mt19937 rng(width * 7 + height);
+    for (auto& bin : input) {
+        bin = std::complex<Real>(rng() % 256, rng() % 256);
+    }
+
+    for (bool inverse : {false, true}) {
+        std::vector<std::complex<Real>> simd = input;
+        std::vector<std::complex<Real>> scalar = input;
+        fd.img = simd.data();
+        FdSystem::setSimdEnabled(true);
+        FdSystem::fft2d(fd, inverse);
+        fd.img = scalar.data();
+        FdSystem::setSimdEnabled(false);
+        FdSystem::fft2d(fd, inverse);
+        FdSystem::setSimdEnabled(true);
+
+        double error = 0;
+        double peak = 0;
+        for (size_t i = 0; i < input.size(); i++) {
+            error = std::max(error, static_cast<double>(std::abs(simd[i] - scalar[i])));
+            peak = std::max(peak, static_cast<double>(std::abs(scalar[i])));
+        }
+        report(inverse ? "simd inv" : "simd", width, height, type, error / peak, tolerance);
+    }
+}
+
+// fft2d on one thread while another keeps resizing the worker pool. Row
+// and column splits do not change the arithmetic, so every run has to
+// match the single-threaded result exactly.
+static void checkPoolResize(int width, int height) {
+    Fd fd{};
+    fd.width = width;
+    fd.height = height;
+    fd.spectrumWidth = width / 2 + 1;
+    std::vector<std::complex<double>> input(static_cast<size_t>(height) * fd.spectrumWidth);
+    std::mt19937 rng(width + height);
+    for (auto& bin : input) {
+        bin = std::complex<double>(rng() % 256, rng() % 256);
+    }
+
+    FdSystem::setThreadCount(1);
+    std::vector<std::complex<double>> expected = input;
+    fd.img = expected.data();
+    FdSystem::fft2d(fd);
+
+    std::atomic<bool> done = false;
+    int mismatches = 0;
+    std::thread transforms([&] {
+        std::vector<std::complex<double>> bins;
+        Fd local = fd;
+        for (int run = 0; run < 200; run++) {
+            bins = input;
+            local.img = bins.data();
+            FdSystem::fft2d(local);
+            mismatches += bins != expected;
+        }
+        done = true;
+    });
+    for (int count = 0; !done; count = (count + 1) % 5) {
+        FdSystem::setThreadCount(count);
+    }
+    transforms.join();
+
+    report("resize", width, height, "double", mismatches, 0);
+}
+
+int main() {
+    std::printf("radix-2 transforms\n");
+    for (auto [width, height] : {std::pair{16, 8}, {64, 32}, {2, 4}}) {
+        checkTransform<double>(width, height, "double", CHECK_TOLERANCE_DOUBLE);
+        checkTransform<float>(width, height, "float", CHECK_TOLERANCE_FLOAT);
+    }
+
+    std::printf("mixed-radix and Bluestein transforms\n");
+    for (auto [width, height] : {std::pair{12, 10}, {35, 21}, {15, 9}, {13, 17}, {22, 26}, {37, 11}, {1, 7}}) {
+        checkTransform<double>(width, height, "double", CHECK_TOLERANCE_DOUBLE);
+        checkTransform<float>(width, height, "float", CHECK_TOLERANCE_FLOAT);
+    }
+
+    std::printf("notch filters on the Nyquist row and column\n");
+    for (auto [width, height] : {std::pair{16, 12}, {15, 9}, {16, 9}, {15, 12}}) {
+        checkNotch(width, height, width / 2, 2);
+        checkNotch(width, height, 3, height / 2);
+        checkNotch(width, height, width / 2, height / 2);
+    }
+
+    // Below FFT_CONVOLUTION_MIN_TAPS convolve runs directly, above it by
+    // overlap-save over FFT tiles
+    std::printf("convolution\n");
+    checkConvolution<double>(45, 37, 3, 3, "double", CHECK_TOLERANCE_DOUBLE);
+    checkConvolution<double>(45, 37, 5, 5, "double", CHECK_TOLERANCE_DOUBLE);
+    checkConvolution<double>(131, 97, 7, 13, "double", CHECK_TOLERANCE_DOUBLE);
+    checkConvolution<double>(83, 150, 31, 17, "double", CHECK_TOLERANCE_DOUBLE);
+    checkConvolution<float>(131, 97, 9, 9, "float", CHECK_TOLERANCE_FLOAT);
+
+    std::printf("plan cache\n");
+    checkPlanCache<double>(32, 16, "double");
+    checkPlanCache<float>(32, 16, "float");
+
+    std::printf("simd against scalar butterflies (%s)\n", FdSystem::isSimdActive() ? "simd active" : "no simd on this cpu");
+    for (auto [width, height] : {std::pair{8, 8}, {64, 32}, {256, 128}, {512, 16}, {97, 33}}) {
+        checkSimd<double>(width, height, "double", CHECK_TOLERANCE_DOUBLE);
+        checkSimd<float>(width, height, "float", CHECK_TOLERANCE_FLOAT);
+    }
+
+    std::printf("pooled workers\n");
+    FdSystem::setThreadCount(4);
+    checkTransform<double>(128, 64, "double", CHECK_TOLERANCE_DOUBLE);
+    checkTransform<float>(128, 64, "float", CHECK_TOLERANCE_FLOAT);
+    checkConvolution<double>(131, 97, 7, 13, "double", CHECK_TOLERANCE_DOUBLE);
+    checkPoolResize(128, 64);
+    FdSystem::setThreadCount(0);
+
+    std::printf(failures ? "%d check(s) failed\n" : "all checks passed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -2,95 +2,815 @@
 #include "FrequencyDomainManager.h"
 #include "ImageManager.h"
 
-#define NEXT_POWER_OF_2(x) ((x) & ((x) - 1)) ? (1 << (32 - __builtin_clz((x) - 1))) : (x)
+// Columns transformed together per tile in the column pass; 16 bins span two
+// (float) or four (double) cache lines of each row
+#define FFT_COLUMN_BLOCK 16
 
-void FdSystem::initFd(Fd& fd, const Image& im) noexcept {
+// Largest prime handled by a mixed-radix stage, longer lengths with a bigger
+// factor go through Bluestein's algorithm
+#define FFT_MAX_RADIX 7
+
+// Kernels with at least this many taps (5x5) are convolved through FFT
+// tiles; below it the direct loop is cheaper
+#define FFT_CONVOLUTION_MIN_TAPS 25
+
+// Smallest overlap-save tile side; tiles grow to four times the kernel so
+// at least three quarters of every tile axis is kept
+#define FFT_CONVOLUTION_MIN_TILE 64
+
+// Transfer functions kept by getTransferFunction, least recently used
+// evicted first; enough for a few filters over a few image sizes
+#define FFT_TRANSFER_CACHE_ENTRIES 8
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FFT_SIMD_AVX2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define FFT_SIMD_NEON 1
+#endif
+
+// Vectorised radix-2/4 butterflies. Within one Stockham stage the twiddles
+// depend only on p, so the `count` butterflies at consecutive q read and
+// write contiguous runs and share w1..w3; these kernels run that q loop a
+// register at a time on raw (re, im) pairs. Each returns how many q it
+// handled; the caller finishes the tail with the scalar butterflies.
+#if FFT_SIMD_AVX2
+
+static bool cpuHasSimd() noexcept {
+    static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return supported;
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256d mulAvx2(__m256d a, __m256d wr, __m256d wi) noexcept {
+    return _mm256_fmaddsub_pd(a, wr, _mm256_mul_pd(_mm256_permute_pd(a, 0x5), wi));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 mulAvx2(__m256 a, __m256 wr, __m256 wi) noexcept {
+    return _mm256_fmaddsub_ps(a, wr, _mm256_mul_ps(_mm256_permute_ps(a, 0xB1), wi));
+}
+
+__attribute__((target("avx2,fma")))
+static int butterflyAvx2(const std::complex<double>* in, std::complex<double>* out, int radix, int span, int stride,
+                         int count, const std::complex<double>* twiddle, bool inverse) noexcept {
+    const double* src = reinterpret_cast<const double*>(in);
+    double* dst = reinterpret_cast<double*>(out);
+    const __m256d rotationSign = inverse ? _mm256_set_pd(-0.0, 0.0, -0.0, 0.0) : _mm256_set_pd(0.0, -0.0, 0.0, -0.0);
+    __m256d wr[3];
+    __m256d wi[3];
+    for (int k = 0; k < radix - 1; k++) {
+        wr[k] = _mm256_set1_pd(twiddle[k].real());
+        wi[k] = _mm256_set1_pd(twiddle[k].imag());
+    }
+
+    int q = 0;
+    for (; q + 2 <= count; q += 2) {
+        if (radix == 2) {
+            __m256d a0 = _mm256_loadu_pd(src + 2 * q);
+            __m256d a1 = _mm256_loadu_pd(src + 2 * (q + span));
+            _mm256_storeu_pd(dst + 2 * q, _mm256_add_pd(a0, a1));
+            _mm256_storeu_pd(dst + 2 * (q + stride), mulAvx2(_mm256_sub_pd(a0, a1), wr[0], wi[0]));
+        } else {
+            __m256d a0 = _mm256_loadu_pd(src + 2 * q);
+            __m256d a1 = _mm256_loadu_pd(src + 2 * (q + span));
+            __m256d a2 = _mm256_loadu_pd(src + 2 * (q + 2 * span));
+            __m256d a3 = _mm256_loadu_pd(src + 2 * (q + 3 * span));
+            __m256d sum02 = _mm256_add_pd(a0, a2);
+            __m256d diff02 = _mm256_sub_pd(a0, a2);
+            __m256d sum13 = _mm256_add_pd(a1, a3);
+            __m256d diff13 = _mm256_sub_pd(a1, a3);
+            diff13 = _mm256_xor_pd(_mm256_permute_pd(diff13, 0x5), rotationSign);
+            _mm256_storeu_pd(dst + 2 * q, _mm256_add_pd(sum02, sum13));
+            _mm256_storeu_pd(dst + 2 * (q + stride), mulAvx2(_mm256_add_pd(diff02, diff13), wr[0], wi[0]));
+            _mm256_storeu_pd(dst + 2 * (q + 2 * stride), mulAvx2(_mm256_sub_pd(sum02, sum13), wr[1], wi[1]));
+            _mm256_storeu_pd(dst + 2 * (q + 3 * stride), mulAvx2(_mm256_sub_pd(diff02, diff13), wr[2], wi[2]));
+        }
+    }
+    return q;
+}
+
+__attribute__((target("avx2,fma")))
+static int butterflyAvx2(const std::complex<float>* in, std::complex<float>* out, int radix, int span, int stride,
+                         int count, const std::complex<float>* twiddle, bool inverse) noexcept {
+    const float* src = reinterpret_cast<const float*>(in);
+    float* dst = reinterpret_cast<float*>(out);
+    const __m256 rotationSign = inverse ? _mm256_set_ps(-0.0f, 0.0f, -0.0f, 0.0f, -0.0f, 0.0f, -0.0f, 0.0f)
+                                        : _mm256_set_ps(0.0f, -0.0f, 0.0f, -0.0f, 0.0f, -0.0f, 0.0f, -0.0f);
+    __m256 wr[3];
+    __m256 wi[3];
+    for (int k = 0; k < radix - 1; k++) {
+        wr[k] = _mm256_set1_ps(twiddle[k].real());
+        wi[k] = _mm256_set1_ps(twiddle[k].imag());
+    }
+
+    int q = 0;
+    for (; q + 4 <= count; q += 4) {
+        if (radix == 2) {
+            __m256 a0 = _mm256_loadu_ps(src + 2 * q);
+            __m256 a1 = _mm256_loadu_ps(src + 2 * (q + span));
+            _mm256_storeu_ps(dst + 2 * q, _mm256_add_ps(a0, a1));
+            _mm256_storeu_ps(dst + 2 * (q + stride), mulAvx2(_mm256_sub_ps(a0, a1), wr[0], wi[0]));
+        } else {
+            __m256 a0 = _mm256_loadu_ps(src + 2 * q);
+            __m256 a1 = _mm256_loadu_ps(src + 2 * (q + span));
+            __m256 a2 = _mm256_loadu_ps(src + 2 * (q + 2 * span));
+            __m256 a3 = _mm256_loadu_ps(src + 2 * (q + 3 * span));
+            __m256 sum02 = _mm256_add_ps(a0, a2);
+            __m256 diff02 = _mm256_sub_ps(a0, a2);
+            __m256 sum13 = _mm256_add_ps(a1, a3);
+            __m256 diff13 = _mm256_sub_ps(a1, a3);
+            diff13 = _mm256_xor_ps(_mm256_permute_ps(diff13, 0xB1), rotationSign);
+            _mm256_storeu_ps(dst + 2 * q, _mm256_add_ps(sum02, sum13));
+            _mm256_storeu_ps(dst + 2 * (q + stride), mulAvx2(_mm256_add_ps(diff02, diff13), wr[0], wi[0]));
+            _mm256_storeu_ps(dst + 2 * (q + 2 * stride), mulAvx2(_mm256_sub_ps(sum02, sum13), wr[1], wi[1]));
+            _mm256_storeu_ps(dst + 2 * (q + 3 * stride), mulAvx2(_mm256_sub_ps(diff02, diff13), wr[2], wi[2]));
+        }
+    }
+    return q;
+}
+
+template<typename Real>
+static int butterflySimd(const std::complex<Real>* in, std::complex<Real>* out, int radix, int span, int stride,
+                         int count, const std::complex<Real>* twiddle, bool inverse) noexcept {
+    return butterflyAvx2(in, out, radix, span, stride, count, twiddle, inverse);
+}
+
+#elif FFT_SIMD_NEON
+
+static bool cpuHasSimd() noexcept {
+    return true;
+}
+
+static inline float64x2_t mulNeon(float64x2_t a, float64x2_t wr, float64x2_t wi) noexcept {
+    return vfmaq_f64(vmulq_f64(a, wr), vextq_f64(a, a, 1), wi);
+}
+
+static inline float32x4_t mulNeon(float32x4_t a, float32x4_t wr, float32x4_t wi) noexcept {
+    return vfmaq_f32(vmulq_f32(a, wr), vrev64q_f32(a), wi);
+}
+
+// wi holds (-im, im) so that swap(a) * wi supplies the cross terms
+static int butterflySimd(const std::complex<double>* in, std::complex<double>* out, int radix, int span, int stride,
+                         int count, const std::complex<double>* twiddle, bool inverse) noexcept {
+    const double* src = reinterpret_cast<const double*>(in);
+    double* dst = reinterpret_cast<double*>(out);
+    const float64x2_t rotationSign = inverse ? float64x2_t{1.0, -1.0} : float64x2_t{-1.0, 1.0};
+    float64x2_t wr[3];
+    float64x2_t wi[3];
+    for (int k = 0; k < radix - 1; k++) {
+        wr[k] = vdupq_n_f64(twiddle[k].real());
+        wi[k] = float64x2_t{-twiddle[k].imag(), twiddle[k].imag()};
+    }
+
+    int q = 0;
+    for (; q < count; q++) {
+        if (radix == 2) {
+            float64x2_t a0 = vld1q_f64(src + 2 * q);
+            float64x2_t a1 = vld1q_f64(src + 2 * (q + span));
+            vst1q_f64(dst + 2 * q, vaddq_f64(a0, a1));
+            vst1q_f64(dst + 2 * (q + stride), mulNeon(vsubq_f64(a0, a1), wr[0], wi[0]));
+        } else {
+            float64x2_t a0 = vld1q_f64(src + 2 * q);
+            float64x2_t a1 = vld1q_f64(src + 2 * (q + span));
+            float64x2_t a2 = vld1q_f64(src + 2 * (q + 2 * span));
+            float64x2_t a3 = vld1q_f64(src + 2 * (q + 3 * span));
+            float64x2_t sum02 = vaddq_f64(a0, a2);
+            float64x2_t diff02 = vsubq_f64(a0, a2);
+            float64x2_t sum13 = vaddq_f64(a1, a3);
+            float64x2_t diff13 = vsubq_f64(a1, a3);
+            diff13 = vmulq_f64(vextq_f64(diff13, diff13, 1), rotationSign);
+            vst1q_f64(dst + 2 * q, vaddq_f64(sum02, sum13));
+            vst1q_f64(dst + 2 * (q + stride), mulNeon(vaddq_f64(diff02, diff13), wr[0], wi[0]));
+            vst1q_f64(dst + 2 * (q + 2 * stride), mulNeon(vsubq_f64(sum02, sum13), wr[1], wi[1]));
+            vst1q_f64(dst + 2 * (q + 3 * stride), mulNeon(vsubq_f64(diff02, diff13), wr[2], wi[2]));
+        }
+    }
+    return q;
+}
+
+static int butterflySimd(const std::complex<float>* in, std::complex<float>* out, int radix, int span, int stride,
+                         int count, const std::complex<float>* twiddle, bool inverse) noexcept {
+    const float* src = reinterpret_cast<const float*>(in);
+    float* dst = reinterpret_cast<float*>(out);
+    const float32x4_t rotationSign = inverse ? float32x4_t{1.0f, -1.0f, 1.0f, -1.0f} : float32x4_t{-1.0f, 1.0f, -1.0f, 1.0f};
+    float32x4_t wr[3];
+    float32x4_t wi[3];
+    for (int k = 0; k < radix - 1; k++) {
+        const float im = twiddle[k].imag();
+        wr[k] = vdupq_n_f32(twiddle[k].real());
+        wi[k] = float32x4_t{-im, im, -im, im};
+    }
+
+    int q = 0;
+    for (; q + 2 <= count; q += 2) {
+        if (radix == 2) {
+            float32x4_t a0 = vld1q_f32(src + 2 * q);
+            float32x4_t a1 = vld1q_f32(src + 2 * (q + span));
+            vst1q_f32(dst + 2 * q, vaddq_f32(a0, a1));
+            vst1q_f32(dst + 2 * (q + stride), mulNeon(vsubq_f32(a0, a1), wr[0], wi[0]));
+        } else {
+            float32x4_t a0 = vld1q_f32(src + 2 * q);
+            float32x4_t a1 = vld1q_f32(src + 2 * (q + span));
+            float32x4_t a2 = vld1q_f32(src + 2 * (q + 2 * span));
+            float32x4_t a3 = vld1q_f32(src + 2 * (q + 3 * span));
+            float32x4_t sum02 = vaddq_f32(a0, a2);
+            float32x4_t diff02 = vsubq_f32(a0, a2);
+            float32x4_t sum13 = vaddq_f32(a1, a3);
+            float32x4_t diff13 = vsubq_f32(a1, a3);
+            diff13 = vmulq_f32(vrev64q_f32(diff13), rotationSign);
+            vst1q_f32(dst + 2 * q, vaddq_f32(sum02, sum13));
+            vst1q_f32(dst + 2 * (q + stride), mulNeon(vaddq_f32(diff02, diff13), wr[0], wi[0]));
+            vst1q_f32(dst + 2 * (q + 2 * stride), mulNeon(vsubq_f32(sum02, sum13), wr[1], wi[1]));
+            vst1q_f32(dst + 2 * (q + 3 * stride), mulNeon(vsubq_f32(diff02, diff13), wr[2], wi[2]));
+        }
+    }
+    return q;
+}
+
+#else
+
+static bool cpuHasSimd() noexcept {
+    return false;
+}
+
+template<typename Real>
+static int butterflySimd(const std::complex<Real>*, std::complex<Real>*, int, int, int, int, const std::complex<Real>*, bool) noexcept {
+    return 0;
+}
+
+#endif
+
+template<typename Real>
+void FdSystem::initFd(BasicFd<Real>& fd, const Image& im) noexcept {
     fd.image = const_cast<Image*>(&im);
     fd.imgWidth = im.width;
     fd.imgHeight = im.height;
-    fd.width = NEXT_POWER_OF_2(fd.imgWidth);
-    fd.height = NEXT_POWER_OF_2(fd.imgHeight);
-    fd.img = new Complex[fd.height * fd.width];
-    fd.original = new Complex[fd.height * fd.width];
+    fd.width = fd.imgWidth;
+    fd.height = fd.imgHeight;
+    fd.spectrumWidth = fd.width / 2 + 1;
+    fd.img = new std::complex<Real>[fd.height * fd.spectrumWidth];
+    fd.original = new std::complex<Real>[fd.height * fd.spectrumWidth];
+
+    getPlan<Real>(fd.width, fd.height, false);
+    getPlan<Real>(fd.width, fd.height, true);
 
     transformToFrequencyDomain(fd);
-    shifting(fd);
 }
 
-void FdSystem::destroyFd(Fd& fd) noexcept {
+template<typename Real>
+void FdSystem::destroyFd(BasicFd<Real>& fd) noexcept {
     delete[] fd.img;
     delete[] fd.original;
 }
 
-void FdSystem::fft(Complex* x, int size, bool invert) noexcept {
+template<typename Real>
+const FftPlan<Real>& FdSystem::getPlan(int width, int height, bool invert) noexcept {
+    static std::map<std::tuple<int, int, bool>, std::unique_ptr<FftPlan<Real>>> cache;
+    static std::mutex cacheMutex;
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto& plan = cache[{width, height, invert}];
+    if (!plan) {
+        plan = std::make_unique<FftPlan<Real>>();
+        plan->width = width;
+        plan->height = height;
+        plan->inverse = invert;
+
+        // Even rows run as a width/2-point complex FFT plus a split step,
+        // odd rows as a full width-point complex FFT
+        const bool evenRows = width % 2 == 0;
+        buildKernel(plan->rowKernel, evenRows ? width / 2 : width, invert);
+        buildKernel(plan->columnKernel, height, invert);
+        computeTwiddles(plan->realTwiddles, width, invert);
+
+        size_t rowWork = plan->rowKernel.workSize + (evenRows ? 0 : width);
+        plan->workerScratchSize = static_cast<size_t>(height) * FFT_COLUMN_BLOCK
+                                + std::max(rowWork, plan->columnKernel.workSize);
+    }
+    return *plan;
+}
+
+template<typename Real>
+void FdSystem::computeTwiddles(std::vector<std::complex<Real>>& twiddles, int size, bool invert) noexcept {
+    twiddles.resize(size);
+    const double angle = 2 * M_PI / size * (invert ? -1 : 1);
+    for (int k = 0; k < size; k++) {
+        twiddles[k] = std::complex<Real>(cos(angle * k), sin(angle * k));
+    }
+}
+
+template<typename Real>
+void FdSystem::buildKernel(FftKernel<Real>& kernel, int size, bool invert) noexcept {
+    kernel.size = size;
+    kernel.inverse = invert;
+    kernel.radices.clear();
+    computeTwiddles(kernel.twiddles, size, invert);
+
+    int rest = size;
+    for (int radix : {4, 2, 3, 5, 7}) {
+        while (rest % radix == 0) {
+            kernel.radices.push_back(radix);
+            rest /= radix;
+        }
+    }
+
+    if (rest == 1) {
+        kernel.workSize = size;
+        return;
+    }
+
+    // Bluestein: with c[n] = w^(n^2 / 2), X[k] = c[k] * sum_n (x[n] c[n]) conj(c[k - n]),
+    // a linear convolution evaluated as a power-of-two circular one
+    kernel.radices.clear();
+    int paddedSize = 1;
+    while (paddedSize < 2 * size - 1) {
+        paddedSize <<= 1;
+    }
+    kernel.convolution = std::make_unique<FftKernel<Real>>();
+    buildKernel(*kernel.convolution, paddedSize, false);
+
+    kernel.chirp.resize(size);
+    const double angle = M_PI / size * (invert ? -1 : 1);
+    for (int n = 0; n < size; n++) {
+        long long square = static_cast<long long>(n) * n % (2LL * size);
+        kernel.chirp[n] = std::complex<Real>(cos(angle * square), sin(angle * square));
+    }
+
+    kernel.chirpSpectrum.assign(paddedSize, std::complex<Real>(0, 0));
+    kernel.chirpSpectrum[0] = std::conj(kernel.chirp[0]);
+    for (int n = 1; n < size; n++) {
+        kernel.chirpSpectrum[n] = kernel.chirpSpectrum[paddedSize - n] = std::conj(kernel.chirp[n]);
+    }
+    std::vector<std::complex<Real>> work(paddedSize);
+    stockham(kernel.chirpSpectrum.data(), *kernel.convolution, work.data());
+
+    // Fold the 1/paddedSize of the inverse convolution transform in here
+    for (std::complex<Real>& bin : kernel.chirpSpectrum) {
+        bin /= paddedSize;
+    }
+
+    kernel.workSize = 2 * static_cast<size_t>(paddedSize);
+}
+
+template<typename Real>
+void FdSystem::fft(std::complex<Real>* x, const FftKernel<Real>& kernel, std::complex<Real>* work) noexcept {
+    const int size = kernel.size;
     if (size <= 1) return;
 
-    std::vector<Complex> even(size / 2);
-    std::vector<Complex> odd(size / 2);
+    if (kernel.convolution) {
+        const FftKernel<Real>& convolution = *kernel.convolution;
+        const int paddedSize = convolution.size;
+        std::complex<Real>* a = work;
+
+        for (int n = 0; n < size; n++) {
+            a[n] = x[n] * kernel.chirp[n];
+        }
+        std::fill(a + size, a + paddedSize, std::complex<Real>(0, 0));
+
+        stockham(a, convolution, work + paddedSize);
+        // Inverse transform as conj(forward(conj(.)))
+        for (int k = 0; k < paddedSize; k++) {
+            a[k] = std::conj(a[k] * kernel.chirpSpectrum[k]);
+        }
+        stockham(a, convolution, work + paddedSize);
+
+        for (int k = 0; k < size; k++) {
+            x[k] = kernel.chirp[k] * std::conj(a[k]);
+        }
+    } else {
+        stockham(x, kernel, work);
+    }
 
-    for (int i = 0; i < size / 2; i++) {
-        even[i] = x[2 * i];
-        odd[i] = x[2 * i + 1];
+    if (kernel.inverse) {
+        const double scale = 1.0 / size;
+        for (int i = 0; i < size; i++) {
+            x[i] *= scale;
+        }
     }
+}
 
-    fft(even.data(), size / 2, invert);
-    fft(odd.data(), size / 2, invert);
+// Self-sorting (Stockham) decimation-in-frequency FFT: each stage reads
+// `radix` inputs m apart from one buffer, applies a radix-point DFT and the
+// stage twiddle w_n^(p * u), and writes them interleaved to the other
+// buffer, so the output lands in natural order without a permutation pass
+template<typename Real>
+void FdSystem::stockham(std::complex<Real>* x, const FftKernel<Real>& kernel, std::complex<Real>* work) noexcept {
+    const int size = kernel.size;
+    const std::complex<Real>* w = kernel.twiddles.data();
+    const std::complex<Real> rotation = kernel.inverse ? std::complex<Real>(0, -1) : std::complex<Real>(0, 1);
+    const bool simd = simdEnabled && cpuHasSimd();
 
-    double angle = 2 * M_PI / size * (invert ? -1 : 1);
-    Complex w(1);
-    Complex wn(cos(angle), sin(angle));
+    std::complex<Real>* src = x;
+    std::complex<Real>* dst = work;
+    int length = size;
+    int stride = 1;
 
-    for (int i = 0; i < size / 2; i++) {
-        x[i] = even[i] + w * odd[i];
-        x[i + size / 2] = even[i] - w * odd[i];
-        if (invert) {
-            x[i] /= 2;
-            x[i + size / 2] /= 2;
+    for (int radix : kernel.radices) {
+        const int m = length / radix;
+        const int step = size / radix;
+
+        for (int p = 0; p < m; p++) {
+            int q = 0;
+            if (simd && stride > 1 && (radix == 2 || radix == 4)) {
+                std::complex<Real> twiddle[3] = {w[stride * p]};
+                if (radix == 4) {
+                    twiddle[1] = w[2 * stride * p];
+                    twiddle[2] = w[3 * stride * p];
+                }
+                q = butterflySimd(src + stride * p, dst + stride * radix * p, radix, stride * m, stride,
+                                  stride, twiddle, kernel.inverse);
+            }
+
+            for (; q < stride; q++) {
+                const std::complex<Real>* in = src + q + stride * p;
+                std::complex<Real>* out = dst + q + stride * radix * p;
+                const int span = stride * m;
+
+                if (radix == 2) {
+                    std::complex<Real> a0 = in[0];
+                    std::complex<Real> a1 = in[span];
+                    out[0] = a0 + a1;
+                    out[stride] = (a0 - a1) * w[stride * p];
+                } else if (radix == 4) {
+                    std::complex<Real> a0 = in[0];
+                    std::complex<Real> a1 = in[span];
+                    std::complex<Real> a2 = in[2 * span];
+                    std::complex<Real> a3 = in[3 * span];
+                    std::complex<Real> sum02 = a0 + a2;
+                    std::complex<Real> diff02 = a0 - a2;
+                    std::complex<Real> sum13 = a1 + a3;
+                    std::complex<Real> diff13 = rotation * (a1 - a3);
+                    out[0] = sum02 + sum13;
+                    out[stride] = (diff02 + diff13) * w[stride * p];
+                    out[2 * stride] = (sum02 - sum13) * w[2 * stride * p];
+                    out[3 * stride] = (diff02 - diff13) * w[3 * stride * p];
+                } else {
+                    std::complex<Real> a[FFT_MAX_RADIX];
+                    for (int j = 0; j < radix; j++) {
+                        a[j] = in[j * span];
+                    }
+                    for (int u = 0; u < radix; u++) {
+                        std::complex<Real> sum = a[0];
+                        for (int j = 1; j < radix; j++) {
+                            sum += a[j] * w[step * ((j * u) % radix)];
+                        }
+                        out[u * stride] = sum * w[stride * p * u];
+                    }
+                }
+            }
         }
-        w *= wn;
+
+        std::swap(src, dst);
+        length = m;
+        stride *= radix;
+    }
+
+    if (src != x) {
+        std::copy_n(src, size, x);
     }
 }
 
-void FdSystem::fft2d(Fd& fd, bool invert) noexcept {
-    for (int y = 0; y < fd.height; y++) {
-        fft(&fd.img[y * fd.width], fd.width, invert);
+// Real row of plan.width samples, packed as (x[2n], x[2n+1]) pairs, to its
+// non-redundant bins x[0..width/2]. Even widths run one width/2-point complex
+// FFT and separate the even/odd spectra with E[k] = (Z[k] + conj(Z[m-k])) / 2
+// and O[k] = (Z[k] - conj(Z[m-k])) / 2i; odd widths transform the full row.
+template<typename Real>
+void FdSystem::realForward(std::complex<Real>* x, const FftPlan<Real>& plan, std::complex<Real>* work) noexcept {
+    if (plan.width % 2 != 0) {
+        std::complex<Real>* row = work;
+        for (int n = 0; n < plan.width; n++) {
+            row[n] = (n & 1) ? x[n / 2].imag() : x[n / 2].real();
+        }
+        fft(row, plan.rowKernel, work + plan.width);
+        std::copy_n(row, plan.width / 2 + 1, x);
+        return;
     }
 
-    std::vector<Complex> column(fd.height);
-    for (int x = 0; x < fd.width; x++) {
-        for (int y = 0; y < fd.height; y++) {
-            column[y] = fd.img[y * fd.width + x];
+    const int m = plan.width / 2;
+    const std::complex<Real>* w = plan.realTwiddles.data();
+
+    fft(x, plan.rowKernel, work);
+
+    const std::complex<Real> z0 = x[0];
+    x[0] = std::complex<Real>(z0.real() + z0.imag(), 0);
+    x[m] = std::complex<Real>(z0.real() - z0.imag(), 0);
+
+    for (int k = 1; k <= m / 2; k++) {
+        const int j = m - k;
+        const std::complex<Real> zk = x[k];
+        const std::complex<Real> zj = x[j];
+        const std::complex<Real> even = Real(0.5) * (zk + std::conj(zj));
+        const std::complex<Real> odd = std::complex<Real>(0, -0.5) * (zk - std::conj(zj));
+        x[k] = even + w[k] * odd;
+        x[j] = std::conj(even) + w[j] * std::conj(odd);
+    }
+}
+
+// Inverse of realForward: bins x[0..width/2] back to width real samples packed
+// as (x[2n], x[2n+1]) pairs. Assumes a Hermitian full spectrum.
+template<typename Real>
+void FdSystem::realInverse(std::complex<Real>* x, const FftPlan<Real>& plan, std::complex<Real>* work) noexcept {
+    if (plan.width % 2 != 0) {
+        const int bins = plan.width / 2 + 1;
+        std::complex<Real>* row = work;
+        row[0] = x[0];
+        for (int k = 1; k < bins; k++) {
+            row[k] = x[k];
+            row[plan.width - k] = std::conj(x[k]);
         }
-        fft(column.data(), fd.height, invert);
-        for (int y = 0; y < fd.height; y++) {
-            fd.img[y * fd.width + x] = column[y];
+        fft(row, plan.rowKernel, work + plan.width);
+        for (int n = 0; n < plan.width; n += 2) {
+            x[n / 2] = std::complex<Real>(row[n].real(), n + 1 < plan.width ? row[n + 1].real() : Real(0));
+        }
+        return;
+    }
+
+    const int m = plan.width / 2;
+    const std::complex<Real>* w = plan.realTwiddles.data();
+
+    const std::complex<Real> x0 = x[0];
+    const std::complex<Real> xm = x[m];
+    x[0] = Real(0.5) * (x0 + std::conj(xm)) + std::complex<Real>(0, 0.5) * (x0 - std::conj(xm));
+
+    for (int k = 1; k <= m / 2; k++) {
+        const int j = m - k;
+        const std::complex<Real> xk = x[k];
+        const std::complex<Real> xj = x[j];
+        const std::complex<Real> evenK = Real(0.5) * (xk + std::conj(xj));
+        const std::complex<Real> oddK = Real(0.5) * (xk - std::conj(xj)) * w[k];
+        const std::complex<Real> evenJ = Real(0.5) * (xj + std::conj(xk));
+        const std::complex<Real> oddJ = Real(0.5) * (xj - std::conj(xk)) * w[j];
+        x[k] = evenK + std::complex<Real>(0, 1) * oddK;
+        x[j] = evenJ + std::complex<Real>(0, 1) * oddJ;
+    }
+
+    fft(x, plan.rowKernel, work);
+}
+
+template<typename Real>
+void FdSystem::fft2d(BasicFd<Real>& fd, bool invert) noexcept {
+    fft2d(fd, getPlan<Real>(fd.width, fd.height, invert));
+}
+
+// The plan is shared between threads and never written; the scratch for
+// each worker's column tile and fft work belongs to the calling thread and
+// is kept between calls. Workers reach it through `base`, since naming the
+// thread_local from their own threads would give them their own copy.
+template<typename Real>
+void FdSystem::fft2d(BasicFd<Real>& fd, const FftPlan<Real>& plan) noexcept {
+    const int blocks = (fd.spectrumWidth + FFT_COLUMN_BLOCK - 1) / FFT_COLUMN_BLOCK;
+    const int workers = std::clamp(getThreadCount(), 1, std::min(fd.height, blocks));
+    const size_t tileSize = static_cast<size_t>(fd.height) * FFT_COLUMN_BLOCK;
+    thread_local std::vector<std::complex<Real>> scratch;
+    if (scratch.size() < plan.workerScratchSize * workers) {
+        scratch.resize(plan.workerScratchSize * workers);
+    }
+    std::complex<Real>* base = scratch.data();
+
+    // Every row and column block is transformed by the same code whichever
+    // worker picks it up, so the result does not depend on the split.
+    // Joining the row workers is the barrier before the column pass.
+    auto rowPass = [&](int begin, int end, int worker) {
+        std::complex<Real>* work = base + plan.workerScratchSize * worker + tileSize;
+        for (int y = begin; y < end; y++) {
+            std::complex<Real>* row = &fd.img[y * fd.spectrumWidth];
+            if (plan.inverse) {
+                realInverse(row, plan, work);
+            } else {
+                realForward(row, plan, work);
+            }
+        }
+    };
+
+    auto columnPass = [&](int begin, int end, int worker) {
+        std::complex<Real>* tile = base + plan.workerScratchSize * worker;
+        for (int block = begin; block < end; block++) {
+            int x = block * FFT_COLUMN_BLOCK;
+            columnBlock(fd, plan, x, std::min(FFT_COLUMN_BLOCK, fd.spectrumWidth - x), tile, tile + tileSize);
+        }
+    };
+
+    if (!plan.inverse) {
+        runWorkers(fd.height, workers, rowPass);
+    }
+
+    runWorkers(blocks, workers, columnPass);
+
+    if (plan.inverse) {
+        runWorkers(fd.height, workers, rowPass);
+    }
+}
+
+// One runWorkers call, chunk i covering [i * chunkSize, (i + 1) * chunkSize).
+// remaining only changes under the pool mutex, so the caller cannot return
+// while the last chunk still touches the batch.
+struct WorkerBatch {
+    const std::function<void(int, int, int)>* work;
+    int chunkSize;
+    int remaining;
+    std::condition_variable finished;
+};
+
+struct WorkerChunk {
+    WorkerBatch* batch;
+    int index;
+};
+
+// getThreadCount() - 1 threads, started on first use and kept until the
+// thread count changes, so repeated small transforms do not pay thread
+// start-up each time. Each runWorkers call holds its own reference, so a
+// pool replaced by setThreadCount mid-batch lives until that batch ends.
+struct WorkerPool {
+    std::vector<std::thread> threads;
+    std::deque<WorkerChunk> chunks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : threads) {
+            t.join();
+        }
+    }
+};
+
+static std::mutex workerPoolMutex;
+static std::shared_ptr<WorkerPool> workerPool;
+
+// Runs one chunk with the pool mutex released; `lock` holds it on entry and exit
+static void runChunk(const WorkerChunk& chunk, std::unique_lock<std::mutex>& lock) noexcept {
+    WorkerBatch& batch = *chunk.batch;
+    const int begin = chunk.index * batch.chunkSize;
+    lock.unlock();
+    (*batch.work)(begin, begin + batch.chunkSize, chunk.index);
+    lock.lock();
+    if (--batch.remaining == 0) {
+        batch.finished.notify_all();
+    }
+}
+
+static void workerLoop(WorkerPool& pool) noexcept {
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    while (true) {
+        pool.wake.wait(lock, [&] { return pool.stopping || !pool.chunks.empty(); });
+        if (pool.stopping) {
+            return;
+        }
+        WorkerChunk chunk = pool.chunks.front();
+        pool.chunks.pop_front();
+        runChunk(chunk, lock);
+    }
+}
+
+static std::shared_ptr<WorkerPool> getWorkerPool(int threads) noexcept {
+    std::lock_guard<std::mutex> lock(workerPoolMutex);
+    if (!workerPool) {
+        workerPool = std::make_shared<WorkerPool>();
+        for (int i = 1; i < threads; ++i) {
+            workerPool->threads.emplace_back(workerLoop, std::ref(*workerPool));
+        }
+    }
+    return workerPool;
+}
+
+// Splits [0, count) into `workers` contiguous chunks and queues all but the
+// last on the worker pool. The calling thread runs the last chunk, then any
+// of its chunks no pool thread has taken yet, so a pool busy with another
+// caller's batch never stalls it.
+void FdSystem::runWorkers(int count, int workers, const std::function<void(int, int, int)>& work) noexcept {
+    if (workers <= 1) {
+        work(0, count, 0);
+        return;
+    }
+
+    const std::shared_ptr<WorkerPool> owner = getWorkerPool(getThreadCount());
+    WorkerPool& pool = *owner;
+    WorkerBatch batch{&work, count / workers, workers - 1, {}};
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    for (int i = 0; i < workers - 1; ++i) {
+        pool.chunks.push_back({&batch, i});
+    }
+    lock.unlock();
+    pool.wake.notify_all();
+    work((workers - 1) * batch.chunkSize, count, workers - 1);
+
+    lock.lock();
+    while (batch.remaining > 0) {
+        auto own = std::find_if(pool.chunks.begin(), pool.chunks.end(), [&](const WorkerChunk& c) { return c.batch == &batch; });
+        if (own == pool.chunks.end()) {
+            batch.finished.wait(lock, [&] { return batch.remaining == 0; });
+            break;
+        }
+        WorkerChunk chunk = *own;
+        pool.chunks.erase(own);
+        runChunk(chunk, lock);
+    }
+}
+
+// Changing the count restarts the worker pool. Batches already running
+// finish on the old one, which is joined when the last of them returns.
+void FdSystem::setThreadCount(int count) noexcept {
+    std::shared_ptr<WorkerPool> retired;
+    {
+        std::lock_guard<std::mutex> lock(workerPoolMutex);
+        threadCount = std::max(0, count);
+        retired = std::move(workerPool);
+    }
+}
+
+void FdSystem::setSimdEnabled(bool enabled) noexcept {
+    simdEnabled = enabled;
+}
+
+bool FdSystem::isSimdActive() noexcept {
+    return simdEnabled && cpuHasSimd();
+}
+
+int FdSystem::getThreadCount() noexcept {
+    const int count = threadCount;
+    if (count > 0) {
+        return count;
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Transforms `count` adjacent columns starting at `firstColumn`. They are
+// gathered row by row into `tile` (one contiguous column per block entry)
+// so each image row is read as a single run instead of one strided element
+// per column.
+template<typename Real>
+void FdSystem::columnBlock(BasicFd<Real>& fd, const FftPlan<Real>& plan, int firstColumn, int count, std::complex<Real>* tile, std::complex<Real>* work) noexcept {
+    for (int y = 0; y < fd.height; y++) {
+        const std::complex<Real>* row = &fd.img[y * fd.spectrumWidth + firstColumn];
+        for (int b = 0; b < count; b++) {
+            tile[b * fd.height + y] = row[b];
+        }
+    }
+
+    for (int b = 0; b < count; b++) {
+        fft(&tile[b * fd.height], plan.columnKernel, work);
+    }
+
+    for (int y = 0; y < fd.height; y++) {
+        std::complex<Real>* row = &fd.img[y * fd.spectrumWidth + firstColumn];
+        for (int b = 0; b < count; b++) {
+            row[b] = tile[b * fd.height + y];
         }
     }
 }
 
-void FdSystem::transformToFrequencyDomain(Fd& fd) noexcept {
+template<typename Real>
+void FdSystem::transformToFrequencyDomain(BasicFd<Real>& fd) noexcept {
     for (int y = 0; y < fd.height; y++) {
-        for (int x = 0; x < fd.width; x++) {
-            int color = ImageSystem::getRGB(*fd.image, x, y);
-            int gray = color & 0xff;
-            fd.img[y * fd.width + x] = Complex(gray, 0);
+        std::complex<Real>* row = &fd.img[y * fd.spectrumWidth];
+        for (int x = 0; x < fd.width; x += 2) {
+            int gray0 = 0;
+            int gray1 = 0;
+            if (y < fd.imgHeight) {
+                if (x < fd.imgWidth) {
+                    gray0 = ImageSystem::getRGB(*fd.image, x, y) & 0xff;
+                }
+                if (x + 1 < fd.imgWidth) {
+                    gray1 = ImageSystem::getRGB(*fd.image, x + 1, y) & 0xff;
+                }
+            }
+            row[x / 2] = std::complex<Real>(gray0, gray1);
         }
     }
-    
-    fft2d(fd);
-    
-    std::copy_n(fd.img, fd.height * fd.width, fd.original);
+
+    fft2d(fd, getPlan<Real>(fd.width, fd.height, false));
+
+    std::copy_n(fd.img, fd.height * fd.spectrumWidth, fd.original);
+}
+
+// Bin (u, v) of the full, unshifted spectrum, mirrored through
+// X[v][u] = conj(X[-v][-u]) when u falls in the half that is not stored
+template<typename Real>
+std::complex<Real> FdSystem::getBin(const BasicFd<Real>& fd, int u, int v) noexcept {
+    if (u < fd.spectrumWidth) {
+        return fd.img[v * fd.spectrumWidth + u];
+    }
+    return std::conj(fd.img[((fd.height - v) % fd.height) * fd.spectrumWidth + (fd.width - u)]);
 }
 
-bool FdSystem::writeSpectrumLogScale(Fd& fd, std::string_view fileName) noexcept {
+template<typename Real>
+bool FdSystem::writeSpectrumLogScale(BasicFd<Real>& fd, std::string_view fileName) noexcept {
     const int byteDepth = 3;
     size_t bufferSize = fd.height * fd.width * byteDepth;
     std::vector<unsigned char> buf(bufferSize);
 
+    // Conjugate bins share a magnitude, so the stored half covers the range
     double max = -std::numeric_limits<double>::infinity();
     double min = std::numeric_limits<double>::infinity();
 
-    for (int i = 0; i < fd.height * fd.width; ++i) {
+    for (int i = 0; i < fd.height * fd.spectrumWidth; ++i) {
         double magnitude = std::abs(fd.img[i]);
         double logMagnitude = magnitude > 1.0 ? std::log10(magnitude) : 0.0;
         max = std::max(max, logMagnitude);
@@ -98,18 +818,24 @@ bool FdSystem::writeSpectrumLogScale(Fd& fd, std::string_view fileName) noexcept
     }
 
     double scale = 255.0 / (max - min);
-    for (int i = 0; i < fd.height * fd.width; ++i) {
-        double magnitude = std::abs(fd.img[i]);
-        double logMagnitude = magnitude > 1.0 ? std::log10(magnitude) : 0.0;
-        int color = static_cast<int>((logMagnitude - min) * scale);
-        color = std::clamp(color, 0, 255);
-        buf[i * byteDepth] = buf[i * byteDepth + 1] = buf[i * byteDepth + 2] = color;
+    for (int y = 0; y < fd.height; ++y) {
+        const int v = (y + (fd.height + 1) / 2) % fd.height;
+        for (int x = 0; x < fd.width; ++x) {
+            const int u = (x + (fd.width + 1) / 2) % fd.width;
+            double magnitude = std::abs(getBin(fd, u, v));
+            double logMagnitude = magnitude > 1.0 ? std::log10(magnitude) : 0.0;
+            int color = static_cast<int>((logMagnitude - min) * scale);
+            color = std::clamp(color, 0, 255);
+            int i = y * fd.width + x;
+            buf[i * byteDepth] = buf[i * byteDepth + 1] = buf[i * byteDepth + 2] = color;
+        }
     }
 
     return writeBufferToBMP(fd, fileName, buf.data(), bufferSize);
 }
 
-bool FdSystem::writePhase(Fd& fd, std::string_view fileName) noexcept {
+template<typename Real>
+bool FdSystem::writePhase(BasicFd<Real>& fd, std::string_view fileName) noexcept {
     const int byteDepth = 3;
     size_t bufferSize = fd.height * fd.width * byteDepth;
     std::vector<unsigned char> buf(bufferSize);
@@ -118,17 +844,23 @@ bool FdSystem::writePhase(Fd& fd, std::string_view fileName) noexcept {
     const double max = M_PI;
 
     double scale = 255.0 / (max - min);
-    for (int i = 0; i < fd.height * fd.width; ++i) {
-        double phase = std::arg(fd.img[i]);
-        int color = static_cast<int>((phase - min) * scale);
-        color = std::clamp(color, 0, 255);
-        buf[i * byteDepth] = buf[i * byteDepth + 1] = buf[i * byteDepth + 2] = color;
+    for (int y = 0; y < fd.height; ++y) {
+        const int v = (y + (fd.height + 1) / 2) % fd.height;
+        for (int x = 0; x < fd.width; ++x) {
+            const int u = (x + (fd.width + 1) / 2) % fd.width;
+            double phase = std::arg(getBin(fd, u, v));
+            int color = static_cast<int>((phase - min) * scale);
+            color = std::clamp(color, 0, 255);
+            int i = y * fd.width + x;
+            buf[i * byteDepth] = buf[i * byteDepth + 1] = buf[i * byteDepth + 2] = color;
+        }
     }
 
     return writeBufferToBMP(fd, fileName, buf.data(), bufferSize);
 }
 
-bool FdSystem::writeBufferToBMP(Fd& fd, std::string_view fileName, const unsigned char* buf, size_t bufferSize) noexcept {
+template<typename Real>
+bool FdSystem::writeBufferToBMP(BasicFd<Real>& fd, std::string_view fileName, const unsigned char* buf, size_t bufferSize) noexcept {
     FILE* fo = fopen(fileName.data(), "wb");
     if (!fo) {
         return false;
@@ -173,54 +905,313 @@ bool FdSystem::writeBufferToBMP(Fd& fd, std::string_view fileName, const unsigne
     return true;
 }
 
-void FdSystem::shifting(Fd& fd) noexcept {
-    const int halfWidth = fd.width / 2;
-    const int halfHeight = fd.height / 2;
+template<typename Real>
+void FdSystem::getInverse(BasicFd<Real>& fd) noexcept {
+    fft2d(fd, getPlan<Real>(fd.width, fd.height, true));
 
-    std::vector<Complex> temp(std::max(fd.width, fd.height));
+    for (int y = 0; y < fd.imgHeight; y++) {
+        const std::complex<Real>* row = &fd.img[y * fd.spectrumWidth];
+        for (int x = 0; x < fd.imgWidth; x++) {
+            double value = (x & 1) ? row[x / 2].imag() : row[x / 2].real();
+            int gray = static_cast<int>(std::lround(value));
+            gray = std::clamp(gray, 0, 255);
+            int color = (gray << 16) | (gray << 8) | gray;
+            ImageSystem::setRGB(*fd.image, x, y, color);
+        }
+    }
+}
 
-    for (int y = 0; y < fd.height; y++) {
-        std::copy_n(&fd.img[y * fd.width], fd.width, temp.begin());
-        std::rotate(temp.begin(), temp.begin() + halfWidth, temp.end());
-        std::copy_n(temp.begin(), fd.width, &fd.img[y * fd.width]);
+template<typename Real>
+void FdSystem::ILPF(BasicFd<Real>& fd, double radius) noexcept {
+    if (radius <= 0 || radius > std::min(fd.width/2, fd.height/2)) {
+        return;
     }
+    applyFilter(fd, FilterSpec{FilterBand::LowPass, FilterShape::Ideal, radius});
+}
 
-    for (int x = 0; x < fd.width; x++) {
-        for (int y = 0; y < fd.height; y++) {
-            temp[y] = fd.img[y * fd.width + x];
-        }
-        std::rotate(temp.begin(), temp.begin() + halfHeight, temp.begin() + fd.height);
-        for (int y = 0; y < fd.height; y++) {
-            fd.img[y * fd.width + x] = temp[y];
-        }
+template<typename Real>
+void FdSystem::applyFilter(BasicFd<Real>& fd, const FilterSpec& spec, bool fromOriginal) noexcept {
+    const auto transfer = getTransferFunction<Real>(fd.width, fd.height, spec);
+    const Real* h = transfer->data();
+    const Real* src = reinterpret_cast<const Real*>(fromOriginal ? fd.original : fd.img);
+    Real* dst = reinterpret_cast<Real*>(fd.img);
+
+    // H is real and even, so filtering is a complex-by-real multiply of each
+    // stored bin and the half spectrum stays Hermitian
+    const size_t bins = static_cast<size_t>(fd.height) * fd.spectrumWidth;
+    for (size_t i = 0; i < bins; i++) {
+        dst[2 * i] = src[2 * i] * h[i];
+        dst[2 * i + 1] = src[2 * i + 1] * h[i];
     }
 }
 
-void FdSystem::getInverse(Fd& fd) noexcept {
-    shifting(fd);
-    fft2d(fd, true);
+// The cache holds the FFT_TRANSFER_CACHE_ENTRIES most recently used
+// functions, newest last. A caller's shared_ptr keeps its function alive
+// after eviction, and a miss is built outside the lock.
+template<typename Real>
+std::shared_ptr<const std::vector<Real>> FdSystem::getTransferFunction(int width, int height, const FilterSpec& spec) noexcept {
+    using Key = std::tuple<int, int, int, int, double, double, int, int, int>;
+    static std::vector<std::pair<Key, std::shared_ptr<const std::vector<Real>>>> cache;
+    static std::mutex cacheMutex;
 
-    for (int y = 0; y < fd.height; y++) {
-        for (int x = 0; x < fd.width; x++) {
-            int gray = static_cast<int>(fd.img[y * fd.width + x].real());
-            gray = std::clamp(gray, 0, 255);
-            int color = (gray << 16) | (gray << 8) | gray;
-            ImageSystem::setRGB(*fd.image, x, y, color);
+    const Key key{width, height, static_cast<int>(spec.band), static_cast<int>(spec.shape),
+                  spec.cutoff, spec.bandWidth, spec.order, spec.notchU, spec.notchV};
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        auto it = std::find_if(cache.begin(), cache.end(), [&](const auto& entry) { return entry.first == key; });
+        if (it != cache.end()) {
+            std::rotate(it, it + 1, cache.end());
+            return cache.back().second;
+        }
+    }
+
+    const int spectrumWidth = width / 2 + 1;
+    auto h = std::make_shared<std::vector<Real>>(static_cast<size_t>(height) * spectrumWidth);
+    // Distances are measured from DC in signed frequency, which is the
+    // centre of the shifted spectrum the writers display
+    for (int v = 0; v < height; v++) {
+        int fy = v <= (height - 1) / 2 ? v : v - height;
+        for (int u = 0; u < spectrumWidth; u++) {
+            (*h)[v * spectrumWidth + u] = static_cast<Real>(transferValue(spec, u, fy, width, height));
         }
     }
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (cache.size() == FFT_TRANSFER_CACHE_ENTRIES) {
+        cache.erase(cache.begin());
+    }
+    cache.emplace_back(key, h);
+    return h;
 }
 
-void FdSystem::ILPF(Fd &fd, double radius) noexcept {
-    if (radius <= 0 || radius > std::min(fd.width/2, fd.height/2)) {
+double FdSystem::transferValue(const FilterSpec& spec, double fu, double fv, int width, int height) noexcept {
+    const double d0 = spec.cutoff;
+    const int n = spec.order;
+    auto lowPass = [&](double d) {
+        switch (spec.shape) {
+        case FilterShape::Ideal:
+            return d <= d0 ? 1.0 : 0.0;
+        case FilterShape::Butterworth:
+            return d0 > 0 ? 1.0 / (1.0 + std::pow(d / d0, 2 * n)) : (d == 0 ? 1.0 : 0.0);
+        case FilterShape::Gaussian:
+            return d0 > 0 ? std::exp(-d * d / (2 * d0 * d0)) : (d == 0 ? 1.0 : 0.0);
+        }
+        return 1.0;
+    };
+    auto bandReject = [&](double d) {
+        const double w = spec.bandWidth;
+        switch (spec.shape) {
+        case FilterShape::Ideal:
+            return d >= d0 - w / 2 && d <= d0 + w / 2 ? 0.0 : 1.0;
+        case FilterShape::Butterworth:
+            if (d * d == d0 * d0) {
+                return 0.0;
+            }
+            return 1.0 / (1.0 + std::pow(d * w / (d * d - d0 * d0), 2 * n));
+        case FilterShape::Gaussian:
+            if (d == 0 || w <= 0) {
+                return d == d0 ? 0.0 : 1.0;
+            }
+            return 1.0 - std::exp(-std::pow((d * d - d0 * d0) / (d * w), 2));
+        }
+        return 1.0;
+    };
+    auto notchAt = [&](double u, double v) {
+        double d1 = std::hypot(u - spec.notchU, v - spec.notchV);
+        double d2 = std::hypot(u + spec.notchU, v + spec.notchV);
+        return (1.0 - lowPass(d1)) * (1.0 - lowPass(d2));
+    };
+    // On even sizes the Nyquist column (u = width / 2) and row (v = height / 2)
+    // have no mirrored partner: each bin there is both +N/2 and -N/2, so it
+    // takes the notches of both. notchAt(-u, -v) == notchAt(u, v), which
+    // keeps the column Hermitian and lets the corner need only one extra term.
+    auto notchReject = [&]() {
+        const bool nyquistU = width % 2 == 0 && std::abs(fu) == width / 2;
+        const bool nyquistV = height % 2 == 0 && std::abs(fv) == height / 2;
+        double reject = notchAt(fu, fv);
+        if (nyquistU) {
+            reject *= notchAt(-fu, fv);
+        } else if (nyquistV) {
+            reject *= notchAt(fu, -fv);
+        }
+        return reject;
+    };
+
+    const double d = std::hypot(fu, fv);
+    switch (spec.band) {
+    case FilterBand::LowPass:     return lowPass(d);
+    case FilterBand::HighPass:    return 1.0 - lowPass(d);
+    case FilterBand::BandReject:  return bandReject(d);
+    case FilterBand::BandPass:    return 1.0 - bandReject(d);
+    case FilterBand::NotchReject: return notchReject();
+    case FilterBand::NotchPass:   return 1.0 - notchReject();
+    }
+    return 1.0;
+}
+template<typename Real>
+void FdSystem::convolve(const Real* src, Real* dst, int width, int height, const Real* kernel, int kernelWidth, int kernelHeight) noexcept {
+    if (kernelWidth > width || kernelHeight > height) {
         return;
     }
-    int centerX = fd.width/2;
-    int centerY = fd.height/2;
-    for (int x = 0; x < fd.height; x++) {
-        for (int y = 0; y < fd.width; y++) {
-            if ((x - centerX) * (x - centerX) + (y - centerY) * (y - centerY) > radius * radius) {
-                fd.img[y * fd.width + x] = Complex(0, 0);
+    if (kernelWidth * kernelHeight < FFT_CONVOLUTION_MIN_TAPS) {
+        convolveDirect(src, dst, width, height, kernel, kernelWidth, kernelHeight);
+    } else {
+        convolveTiled(src, dst, width, height, kernel, kernelWidth, kernelHeight);
+    }
+}
+
+template<typename Real>
+void FdSystem::convolveDirect(const Real* src, Real* dst, int width, int height, const Real* kernel, int kernelWidth, int kernelHeight) noexcept {
+    const int rows = height - kernelHeight + 1;
+    const int columns = width - kernelWidth + 1;
+    const int workers = std::clamp(getThreadCount(), 1, rows);
+
+    runWorkers(rows, workers, [&](int begin, int end, int) {
+        for (int y = begin; y < end; y++) {
+            Real* out = &dst[(y + kernelHeight / 2) * width + kernelWidth / 2];
+            for (int x = 0; x < columns; x++) {
+                Real sum = 0;
+                for (int i = 0; i < kernelHeight; i++) {
+                    const Real* in = &src[(y + i) * width + x];
+                    const Real* k = &kernel[i * kernelWidth];
+                    for (int j = 0; j < kernelWidth; j++) {
+                        sum += in[j] * k[j];
+                    }
+                }
+                out[x] = sum;
             }
         }
+    });
+}
+
+// Overlap-save: each size x size input tile is multiplied in the frequency
+// domain by the flipped, zero-padded kernel. Outputs whose window wraps
+// around the tile edge are discarded, so consecutive tiles overlap by
+// kernel - 1 samples and the rest is exact linear correlation.
+template<typename Real>
+void FdSystem::convolveTiled(const Real* src, Real* dst, int width, int height, const Real* kernel, int kernelWidth, int kernelHeight) noexcept {
+    const int size = std::max<int>(FFT_CONVOLUTION_MIN_TILE, std::bit_ceil(4u * std::max(kernelWidth, kernelHeight)));
+    const int spectrumWidth = size / 2 + 1;
+    const int stepX = size - kernelWidth + 1;
+    const int stepY = size - kernelHeight + 1;
+    const int columns = width - kernelWidth + 1;
+    const int rows = height - kernelHeight + 1;
+    const int tilesX = (columns + stepX - 1) / stepX;
+    const int tiles = tilesX * ((rows + stepY - 1) / stepY);
+
+    const FftPlan<Real>& forward = getPlan<Real>(size, size, false);
+    const FftPlan<Real>& inverse = getPlan<Real>(size, size, true);
+    const size_t tileBins = static_cast<size_t>(size) * spectrumWidth;
+    const size_t workerSize = tileBins + std::max(forward.workerScratchSize, inverse.workerScratchSize);
+    const int workers = std::clamp(getThreadCount(), 1, tiles);
+    std::vector<std::complex<Real>> buffers(workerSize * workers + tileBins);
+
+    // Real samples are packed two per complex bin along each row
+    auto samples = [&](std::complex<Real>* bins, int y) {
+        return reinterpret_cast<Real*>(bins + static_cast<size_t>(y) * spectrumWidth);
+    };
+
+    BasicFd<Real> kernelFd{};
+    kernelFd.img = buffers.data() + workerSize * workers;
+    kernelFd.width = size;
+    kernelFd.height = size;
+    kernelFd.spectrumWidth = spectrumWidth;
+    for (int i = 0; i < kernelHeight; i++) {
+        Real* row = samples(kernelFd.img, kernelHeight - 1 - i);
+        for (int j = 0; j < kernelWidth; j++) {
+            row[kernelWidth - 1 - j] = kernel[i * kernelWidth + j];
+        }
     }
-}
\ No newline at end of file
+    fft2dSerial(kernelFd, forward, buffers.data());
+
+    runWorkers(tiles, workers, [&](int begin, int end, int worker) {
+        std::complex<Real>* scratch = buffers.data() + workerSize * worker;
+        BasicFd<Real> tile{};
+        tile.img = scratch + std::max(forward.workerScratchSize, inverse.workerScratchSize);
+        tile.width = size;
+        tile.height = size;
+        tile.spectrumWidth = spectrumWidth;
+
+        for (int t = begin; t < end; t++) {
+            const int x0 = (t % tilesX) * stepX;
+            const int y0 = (t / tilesX) * stepY;
+            const int inWidth = std::min(size, width - x0);
+            const int inHeight = std::min(size, height - y0);
+
+            std::fill_n(tile.img, tileBins, std::complex<Real>(0, 0));
+            for (int y = 0; y < inHeight; y++) {
+                std::copy_n(&src[(y0 + y) * width + x0], inWidth, samples(tile.img, y));
+            }
+
+            fft2dSerial(tile, forward, scratch);
+            for (size_t i = 0; i < tileBins; i++) {
+                tile.img[i] *= kernelFd.img[i];
+            }
+            fft2dSerial(tile, inverse, scratch);
+
+            const int outWidth = std::min(stepX, columns - x0);
+            const int outHeight = std::min(stepY, rows - y0);
+            for (int y = 0; y < outHeight; y++) {
+                const Real* in = samples(tile.img, y + kernelHeight - 1) + kernelWidth - 1;
+                Real* out = &dst[(y0 + y + kernelHeight / 2) * width + x0 + kernelWidth / 2];
+                std::copy_n(in, outWidth, out);
+            }
+        }
+    });
+}
+
+// fft2d on the calling thread with caller-owned scratch of
+// plan.workerScratchSize, for transforms that are already run in parallel
+template<typename Real>
+void FdSystem::fft2dSerial(BasicFd<Real>& fd, const FftPlan<Real>& plan, std::complex<Real>* scratch) noexcept {
+    std::complex<Real>* work = scratch + static_cast<size_t>(fd.height) * FFT_COLUMN_BLOCK;
+    auto rowPass = [&]() {
+        for (int y = 0; y < fd.height; y++) {
+            std::complex<Real>* row = &fd.img[y * fd.spectrumWidth];
+            if (plan.inverse) {
+                realInverse(row, plan, work);
+            } else {
+                realForward(row, plan, work);
+            }
+        }
+    };
+
+    if (!plan.inverse) {
+        rowPass();
+    }
+    for (int x = 0; x < fd.spectrumWidth; x += FFT_COLUMN_BLOCK) {
+        columnBlock(fd, plan, x, std::min(FFT_COLUMN_BLOCK, fd.spectrumWidth - x), scratch, work);
+    }
+    if (plan.inverse) {
+        rowPass();
+    }
+}
+
+
+template void FdSystem::initFd<float>(BasicFd<float>& fd, const Image& im) noexcept;
+template void FdSystem::destroyFd<float>(BasicFd<float>& fd) noexcept;
+template void FdSystem::fft2d<float>(BasicFd<float>& fd, bool inverse) noexcept;
+template void FdSystem::fft2d<float>(BasicFd<float>& fd, const FftPlan<float>& plan) noexcept;
+template const FftPlan<float>& FdSystem::getPlan<float>(int width, int height, bool inverse) noexcept;
+template void FdSystem::transformToFrequencyDomain<float>(BasicFd<float>& fd) noexcept;
+template bool FdSystem::writeSpectrumLogScale<float>(BasicFd<float>& fd, std::string_view fileName) noexcept;
+template bool FdSystem::writePhase<float>(BasicFd<float>& fd, std::string_view fileName) noexcept;
+template void FdSystem::ILPF<float>(BasicFd<float>& fd, double radius) noexcept;
+template void FdSystem::applyFilter<float>(BasicFd<float>& fd, const FilterSpec& spec, bool fromOriginal) noexcept;
+template std::shared_ptr<const std::vector<float>> FdSystem::getTransferFunction<float>(int width, int height, const FilterSpec& spec) noexcept;
+template void FdSystem::getInverse<float>(BasicFd<float>& fd) noexcept;
+template void FdSystem::convolve<float>(const float* src, float* dst, int width, int height, const float* kernel, int kernelWidth, int kernelHeight) noexcept;
+
+template void FdSystem::initFd<double>(BasicFd<double>& fd, const Image& im) noexcept;
+template void FdSystem::destroyFd<double>(BasicFd<double>& fd) noexcept;
+template void FdSystem::fft2d<double>(BasicFd<double>& fd, bool inverse) noexcept;
+template void FdSystem::fft2d<double>(BasicFd<double>& fd, const FftPlan<double>& plan) noexcept;
+template const FftPlan<double>& FdSystem::getPlan<double>(int width, int height, bool inverse) noexcept;
+template void FdSystem::transformToFrequencyDomain<double>(BasicFd<double>& fd) noexcept;
+template bool FdSystem::writeSpectrumLogScale<double>(BasicFd<double>& fd, std::string_view fileName) noexcept;
+template bool FdSystem::writePhase<double>(BasicFd<double>& fd, std::string_view fileName) noexcept;
+template void FdSystem::ILPF<double>(BasicFd<double>& fd, double radius) noexcept;
+template void FdSystem::applyFilter<double>(BasicFd<double>& fd, const FilterSpec& spec, bool fromOriginal) noexcept;
+template std::shared_ptr<const std::vector<double>> FdSystem::getTransferFunction<double>(int width, int height, const FilterSpec& spec) noexcept;
+template void FdSystem::getInverse<double>(BasicFd<double>& fd) noexcept;
+template void FdSystem::convolve<double>(const double* src, double* dst, int width, int height, const double* kernel, int kernelWidth, int kernelHeight) noexcept;
\ No newline at end of file
@@ -5,32 +5,158 @@
 struct Image;
 using Complex = std::complex<double>;
 
-struct Fd {
-    Complex* img;
-    Complex* original;
+// Half spectrum of a real image at its own size: height rows of
+// spectrumWidth = width / 2 + 1 bins, DC at index 0, the rest given by
+// X[v][u] = conj(X[-v][-u]). float Real is enough for 8-bit input.
+template<typename Real>
+struct BasicFd {
+    std::complex<Real>* img;
+    std::complex<Real>* original;
     Image* image;
     int width;
     int height;
+    int spectrumWidth;
     int imgWidth;
     int imgHeight;
 };
 
+using Fd = BasicFd<double>;
+using FdFloat = BasicFd<float>;
+
+// One 1D transform length. Lengths made of 2, 3, 5 and 7 run as mixed-radix
+// stages; anything with a larger prime factor is evaluated with Bluestein's
+// chirp-z as a power-of-two circular convolution.
+template<typename Real>
+struct FftKernel {
+    int size;
+    bool inverse;
+    std::vector<int> radices;
+    std::vector<std::complex<Real>> twiddles;
+    std::vector<std::complex<Real>> chirp;
+    std::vector<std::complex<Real>> chirpSpectrum;
+    std::unique_ptr<FftKernel<Real>> convolution;
+    size_t workSize;  // complex elements of scratch fft() needs
+};
+
+// Precomputed tables for one (width, height, direction) transform, shared
+// process-wide through FdSystem::getPlan and read-only once built
+template<typename Real>
+struct FftPlan {
+    int width;
+    int height;
+    bool inverse;
+    FftKernel<Real> rowKernel;
+    FftKernel<Real> columnKernel;
+    std::vector<std::complex<Real>> realTwiddles;
+    size_t workerScratchSize;  // column tile + fft work per fft2d worker
+};
+
+enum class FilterBand {
+    LowPass,
+    HighPass,
+    BandReject,
+    BandPass,
+    NotchReject,
+    NotchPass
+};
+
+enum class FilterShape {
+    Ideal,
+    Butterworth,
+    Gaussian
+};
+
+// One frequency-domain filter. cutoff is D0 (the notch radius for notch
+// filters), bandWidth is W for band filters, order is the Butterworth n and
+// (notchU, notchV) is the signed frequency of a notch; its conjugate mirror
+// is suppressed with it so the result stays a real image.
+struct FilterSpec {
+    FilterBand band;
+    FilterShape shape;
+    double cutoff;
+    double bandWidth = 0;
+    int order = 2;
+    int notchU = 0;
+    int notchV = 0;
+};
+
 struct FdSystem {
 
-    static void initFd(Fd& fd, const Image& im) noexcept;
-    static void destroyFd(Fd& fd) noexcept;
-    static void fft2d(Fd& fd,bool inverse=false) noexcept;
-    static void transformToFrequencyDomain(Fd& fd) noexcept;
-    static bool writeSpectrumLogScale(Fd& fd, std::string_view fileName) noexcept;
-    static bool writePhase(Fd& fd, std::string_view fileName) noexcept;
-    static void ILPF(Fd& fd,double radius) noexcept;
-    static void getInverse(Fd& fd) noexcept;  
+    template<typename Real>
+    static void initFd(BasicFd<Real>& fd, const Image& im) noexcept;
+    template<typename Real>
+    static void destroyFd(BasicFd<Real>& fd) noexcept;
+    template<typename Real>
+    static void fft2d(BasicFd<Real>& fd,bool inverse=false) noexcept;
+    template<typename Real>
+    static void fft2d(BasicFd<Real>& fd, const FftPlan<Real>& plan) noexcept;
+    template<typename Real>
+    static const FftPlan<Real>& getPlan(int width, int height, bool inverse) noexcept;
+    // Workers used by fft2d, 0 means one per hardware thread. They run on a
+    // persistent pool; changing the count restarts it
+    static void setThreadCount(int count) noexcept;
+    static int getThreadCount() noexcept;
+    // Vectorised radix-2/4 butterflies (AVX2+FMA detected at runtime, NEON on
+    // arm64); disabling falls back to the scalar reference path
+    static void setSimdEnabled(bool enabled) noexcept;
+    static bool isSimdActive() noexcept;
+    template<typename Real>
+    static void transformToFrequencyDomain(BasicFd<Real>& fd) noexcept;
+    template<typename Real>
+    static bool writeSpectrumLogScale(BasicFd<Real>& fd, std::string_view fileName) noexcept;
+    template<typename Real>
+    static bool writePhase(BasicFd<Real>& fd, std::string_view fileName) noexcept;
+    template<typename Real>
+    static void ILPF(BasicFd<Real>& fd,double radius) noexcept;
+    // Multiplies the spectrum by the filter's transfer function, built once
+    // per (size, spec) and kept in a small LRU cache. fromOriginal filters the untouched
+    // spectrum instead of the current one, so sweeping several cutoffs over
+    // one image costs a single pass each
+    template<typename Real>
+    static void applyFilter(BasicFd<Real>& fd, const FilterSpec& spec, bool fromOriginal = false) noexcept;
+    template<typename Real>
+    static std::shared_ptr<const std::vector<Real>> getTransferFunction(int width, int height, const FilterSpec& spec) noexcept;
+    // Applies a kernelWidth x kernelHeight kernel to one plane the way the
+    // spatial filters do, dst[y][x] = sum src[y - kh/2 + i][x - kw/2 + j] *
+    // kernel[i][j], writing only pixels whose window fits inside the plane.
+    // Small kernels run directly; larger ones by overlap-save over FFT tiles,
+    // which keeps the per-pixel cost flat in the kernel size
+    template<typename Real>
+    static void convolve(const Real* src, Real* dst, int width, int height, const Real* kernel, int kernelWidth, int kernelHeight) noexcept;
+    template<typename Real>
+    static void getInverse(BasicFd<Real>& fd) noexcept;  
     
 private:
          
-    static void fft(Complex* x, int size,bool inverse=false) noexcept;
-    static void shifting(Fd& fd) noexcept;
-    static bool writeBufferToBMP(Fd& fd, std::string_view fileName, const unsigned char* buf, size_t bufferSize) noexcept;
+    template<typename Real>
+    static void fft(std::complex<Real>* x, const FftKernel<Real>& kernel, std::complex<Real>* work) noexcept;
+    template<typename Real>
+    static void stockham(std::complex<Real>* x, const FftKernel<Real>& kernel, std::complex<Real>* work) noexcept;
+    template<typename Real>
+    static void buildKernel(FftKernel<Real>& kernel, int size, bool inverse) noexcept;
+    template<typename Real>
+    static void computeTwiddles(std::vector<std::complex<Real>>& twiddles, int size, bool inverse) noexcept;
+    template<typename Real>
+    static void realForward(std::complex<Real>* x, const FftPlan<Real>& plan, std::complex<Real>* work) noexcept;
+    template<typename Real>
+    static void realInverse(std::complex<Real>* x, const FftPlan<Real>& plan, std::complex<Real>* work) noexcept;
+    template<typename Real>
+    static void columnBlock(BasicFd<Real>& fd, const FftPlan<Real>& plan, int firstColumn, int count, std::complex<Real>* tile, std::complex<Real>* work) noexcept;
+    template<typename Real>
+    static void fft2dSerial(BasicFd<Real>& fd, const FftPlan<Real>& plan, std::complex<Real>* scratch) noexcept;
+    template<typename Real>
+    static void convolveDirect(const Real* src, Real* dst, int width, int height, const Real* kernel, int kernelWidth, int kernelHeight) noexcept;
+    template<typename Real>
+    static void convolveTiled(const Real* src, Real* dst, int width, int height, const Real* kernel, int kernelWidth, int kernelHeight) noexcept;
+    template<typename Real>
+    static std::complex<Real> getBin(const BasicFd<Real>& fd, int u, int v) noexcept;
+    static double transferValue(const FilterSpec& spec, double fu, double fv, int width, int height) noexcept;
+    static void runWorkers(int count, int workers, const std::function<void(int, int, int)>& work) noexcept;
+
+    inline static std::atomic<int> threadCount = 0;
+    inline static std::atomic<bool> simdEnabled = true;
+    template<typename Real>
+    static bool writeBufferToBMP(BasicFd<Real>& fd, std::string_view fileName, const unsigned char* buf, size_t bufferSize) noexcept;
 
 
 };
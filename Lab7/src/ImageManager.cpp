@@ -213,28 +213,31 @@ void ImageSystem::setTemperature(Image& img) noexcept {
 template<int size>
 void ImageSystem::averagingFilter(Image& img) noexcept {
 
-        std::vector<int> buffer(img.width * img.height * 3);
+    // Window sums per channel through FdSystem::convolve, which switches to
+    // FFT tiles once the box is large. Sums of 8-bit samples are integers,
+    // so rounding recovers them exactly before the integer mean.
+    const int width = img.width;
+    const int height = img.height;
+    const int area = size * size;
+    std::vector<int> buffer(img.width * img.height * 3);
+    std::vector<double> kernel(area, 1.0);
+    std::vector<double> channel(width * height);
+    std::vector<double> sums(width * height);
+    for (int c = 0; c < 3; ++c) {
+        for (int i = 0; i < width * height; ++i) {
+            channel[i] = img.buf[i * 3 + c];
+        }
+        FdSystem::convolve(channel.data(), sums.data(), width, height, kernel.data(), size, size);
         int halfSize = size / 2;
-        for (int y = halfSize; y < img.height - halfSize; ++y) {
-        for (int x = halfSize; x < img.width - halfSize; ++x) {
-        int r = 0, g = 0, b = 0;
-        for (int ky = -halfSize; ky <= halfSize; ++ky) {
-            for (int kx = -halfSize; kx <= halfSize; ++kx) {
-                int index = ((y + ky) * img.width + (x + kx)) * 3;
-                r += img.buf[index];
-                g += img.buf[index + 1];
-                b += img.buf[index + 2];
-                }
-                }
-                int area = size * size;
-                int index = (y * img.width + x) * 3;
-                buffer[index] = r / area;
-                buffer[index + 1] = g / area;
-                buffer[index + 2] = b / area;
-                }
+        for (int y = halfSize; y < height - halfSize; ++y) {
+            for (int x = halfSize; x < width - halfSize; ++x) {
+                int index = y * width + x;
+                buffer[index * 3 + c] = static_cast<int>(std::lround(sums[index])) / area;
             }
-        std::copy(buffer.begin(), buffer.end(), img.buf);
+        }
     }
+    std::copy(buffer.begin(), buffer.end(), img.buf);
+}
 
     template<int size>
     void ImageSystem::medianFilter(Image& img) noexcept {
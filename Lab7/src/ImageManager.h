@@ -6,7 +6,8 @@
 #define BMP_COLOR_TABLE_SIZE 1024
 #define BMP_HEADER_SIZE 54
 
-struct Fd;
+template<typename Real> struct BasicFd;
+using Fd = BasicFd<double>;
 
 struct Image {
     uint32_t width;
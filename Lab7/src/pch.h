@@ -14,6 +14,17 @@
 #include<cstring>
 #include<limits>
 #include <random>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <tuple>
+#include <thread>
+#include <functional>
+#include <bit>
+#include <chrono>
 
 
 
@@ -1,163 +1,10 @@
 #include "pch.h"
 #include "ImageManager.h"
+#include "ThreadPool.h"
 
 #define PATH_IMAGES "/Users/bankzkuma/Desktop/CSKMITL/DIP/Lab/Midterm/images/"
 
 
-template <size_t N>
-int findMedian(std::array<int, N>& window, size_t size) {
-    std::nth_element(window.begin(), window.begin() + size / 2, window.begin() + size);
-    return window[size / 2];
-}
-
-template<int maxWindowSize>
-void adaptiveMedianFilter(Image& img) {
-    int width = img.width;
-    int height = img.height;
-    int channels = img.bitDepth / BYTE; // Assuming 8-bit per channel
-
-    std::vector<uint8_t> output(img.width * img.height * channels);
-    int numThreads = std::thread::hardware_concurrency();
-    std::vector<std::thread> threads;
-    std::mutex mtx;
-
-    auto processChunk = [&](int startY, int endY) {
-        std::array<int, maxWindowSize * maxWindowSize> windowR, windowG, windowB;
-
-        for (int y = startY; y < endY; ++y) {
-            for (int x = 0; x < width; ++x) {
-                bool done = false;
-                int windowSize = 1;
-
-                while (!done && windowSize <= maxWindowSize) {
-                    int halfSize = windowSize / 2;
-                    size_t count = 0;
-
-                    for (int dy = -halfSize; dy <= halfSize; ++dy) {
-                        for (int dx = -halfSize; dx <= halfSize; ++dx) {
-                            int nx = std::clamp(x + dx, 0, width - 1);
-                            int ny = std::clamp(y + dy, 0, height - 1);
-                            int index = (ny * width + nx) * channels;
-                            windowR[count] = img.buf[index];
-                            windowG[count] = img.buf[index + 1];
-                            windowB[count] = img.buf[index + 2];
-                            ++count;
-                        }
-                    }
-
-                    int medianR = findMedian(windowR, count);
-                    int medianG = findMedian(windowG, count);
-                    int medianB = findMedian(windowB, count);
-
-                    int zMinR = *std::min_element(windowR.begin(), windowR.begin() + count);
-                    int zMaxR = *std::max_element(windowR.begin(), windowR.begin() + count);
-                    int zMinG = *std::min_element(windowG.begin(), windowG.begin() + count);
-                    int zMaxG = *std::max_element(windowG.begin(), windowG.begin() + count);
-                    int zMinB = *std::min_element(windowB.begin(), windowB.begin() + count);
-                    int zMaxB = *std::max_element(windowB.begin(), windowB.begin() + count);
-
-                    int index = (y * width + x) * channels;
-                    int zR = img.buf[index];
-                    int zG = img.buf[index + 1];
-                    int zB = img.buf[index + 2];
-
-                    std::lock_guard<std::mutex> lock(mtx);
-                    if (medianR > zMinR && medianR < zMaxR && medianG > zMinG && medianG < zMaxG && medianB > zMinB && medianB < zMaxB) {
-                        if (zR > zMinR && zR < zMaxR && zG > zMinG && zG < zMaxG && zB > zMinB && zB < zMaxB) {
-                            output[index] = zR;
-                            output[index + 1] = zG;
-                            output[index + 2] = zB;
-                        } else {
-                            output[index] = medianR;
-                            output[index + 1] = medianG;
-                            output[index + 2] = medianB;
-                        }
-                        done = true;
-                    } else {
-                        windowSize += 2;
-                    }
-                }
-
-                if (!done) {
-                    std::lock_guard<std::mutex> lock(mtx);
-                    int index = (y * width + x) * channels;
-                    output[index] = img.buf[index];
-                    output[index + 1] = img.buf[index + 1];
-                    output[index + 2] = img.buf[index + 2];
-                }
-            }
-        }
-    };
-
-    int chunkSize = height / numThreads;
-    for (int i = 0; i < numThreads; ++i) {
-        int startY = i * chunkSize;
-        int endY = (i == numThreads - 1) ? height : startY + chunkSize;
-        threads.emplace_back(processChunk, startY, endY);
-    }
-
-    for (auto& t : threads) {
-        t.join();
-    }
-
-    std::copy(output.begin(), output.end(), img.buf);
-}
-
-void applyLaplacianFilter(Image& img) {
-    int width = img.width;
-    int height = img.height;
-    int channels = img.bitDepth / BYTE; // Assuming 8-bit per channel
-    
-    std::array<int, 9> kernel = {0, 1, 0, 1, -4, 1, 0, 1, 0}; // Laplacian kernel
-    int kernelSize = 3;
-    int halfKernelSize = kernelSize / 2;
-
-    std::vector<uint8_t> output(img.width * img.height * channels);
-    int numThreads = std::thread::hardware_concurrency();
-    std::vector<std::thread> threads;
-    std::mutex mtx;
-
-    auto processChunk = [&](int startY, int endY) {
-        for (int y = startY; y < endY; ++y) {
-            for (int x = 0; x < width; ++x) {
-                int index = (y * width + x) * channels;
-
-                for (int c = 0; c < channels; ++c) {
-                    int sum = 0;
-
-                    for (int ky = -halfKernelSize; ky <= halfKernelSize; ++ky) {
-                        for (int kx = -halfKernelSize; kx <= halfKernelSize; ++kx) {
-                            int ny = std::clamp(y + ky, 0, height - 1);
-                            int nx = std::clamp(x + kx, 0, width - 1);
-                            int nIndex = (ny * width + nx) * channels + c;
-                            int kIndex = (ky + halfKernelSize) * kernelSize + (kx + halfKernelSize);
-
-                            sum += img.buf[nIndex] * kernel[kIndex];
-                        }
-                    }
-
-                    int newValue = img.buf[index + c] - sum;
-                    output[index + c] = std::clamp(newValue, 0, 255);
-                }
-            }
-        }
-    };
-
-    int chunkSize = height / numThreads;
-    for (int i = 0; i < numThreads; ++i) {
-        int startY = i * chunkSize;
-        int endY = (i == numThreads - 1) ? height : startY + chunkSize;
-        threads.emplace_back(processChunk, startY, endY);
-    }
-
-    for (auto& t : threads) {
-        t.join();
-    }
-
-    std::copy(output.begin(), output.end(), img.buf);
-}
-
-
 // Function to change colors based on histogram ranges
 void changeColor(Image& img, const std::vector<int>& region, const std::vector<int>& targetColor, const std::vector<std::vector<int>>& colorRange, const std::vector<int>& notChangeColor = {}) {
     int width = img.width;
@@ -260,62 +107,14 @@ void modifyRegion(Image &img,const std::vector<int> & region,const std::vector<i
 
 }
 
+// Every pixel ends up as its window's median (a pixel equal to the median
+// keeps its value), so each pass is a clamped median filter
 template<int size>
-void modifyPixels(Image &img) noexcept {
-    std::vector<uint8_t> tempBuf(img.width * img.height * 3);
-    int halfSize = size / 2;
-
-    for (int y = 0; y < img.height; ++y) {
-        for (int x = 0; x < img.width; ++x) {
-            std::vector<int> rValues, gValues, bValues;
-
-            for (int dy = -halfSize; dy <= halfSize; ++dy) {
-                for (int dx = -halfSize; dx <= halfSize; ++dx) {
-                    int nx = std::clamp(x + dx, 0, static_cast<int>(img.width) - 1);
-                    int ny = std::clamp(y + dy, 0, static_cast<int>(img.height) - 1);
-                    int color = ImageSystem::getRGB(img, nx, ny);
-                    
-                    rValues.push_back((color >> 16) & 0xFF);
-                    gValues.push_back((color >> 8) & 0xFF);
-                    bValues.push_back(color & 0xFF);
-                }
-            }
-
-            // Sort the color values
-            std::sort(rValues.begin(), rValues.end());
-            std::sort(gValues.begin(), gValues.end());
-            std::sort(bValues.begin(), bValues.end());
-
-            // Get the median values
-            int medianR = rValues[rValues.size() / 2];
-            int medianG = gValues[gValues.size() / 2];
-            int medianB = bValues[bValues.size() / 2];
-
-            // Get the center pixel color
-            int centerColor = ImageSystem::getRGB(img, x, y);
-            int centerR = (centerColor >> 16) & 0xFF;
-            int centerG = (centerColor >> 8) & 0xFF;
-            int centerB = centerColor & 0xFF;
-
-            // If the center pixel is different from the median, replace it
-            if (centerR != medianR || centerG != medianG || centerB != medianB) {
-                int newColor = (medianR << 16) | (medianG << 8) | medianB;
-                int index = (y * img.width + x) * 3;
-                tempBuf[index] = medianR;
-                tempBuf[index + 1] = medianG;
-                tempBuf[index + 2] = medianB;
-            } else {
-                // Keep the original color
-                int index = (y * img.width + x) * 3;
-                tempBuf[index] = centerR;
-                tempBuf[index + 1] = centerG;
-                tempBuf[index + 2] = centerB;
-            }
-        }
-    }
-
-    // Copy the modified pixels back to the original image
-    std::copy(tempBuf.begin(), tempBuf.end(), img.buf);
+int modifyPixels(Image &img, int iterations) noexcept {
+    FilterWorkspace workspace;
+    return ImageSystem::iterate(img, iterations, [&](const Image& src, uint8_t* dst) {
+        ImageSystem::windowStatistics<size>(src, BorderMode::Clamp, dst, nullptr, nullptr, &workspace.padded);
+    });
 }
 
 
@@ -337,39 +136,32 @@ int main(){
     }
 
     // Apply adaptive median filter
-    for (int i = 0; i < (1 << 5); ++i) {
-        adaptiveMedianFilter<3>(img);
-    }
+    ImageSystem::adaptiveMedianFilter<3>(img, 1 << 5);
 
 
     // Apply adaptive median filter
-    for (int i = 0; i < (1 << 5); ++i) {
-        adaptiveMedianFilter<5>(img);
-    }
+    ImageSystem::adaptiveMedianFilter<5>(img, 1 << 5);
 
 
     // Apply adaptive median filter
-    for (int i = 0; i < (1 << 5); ++i) {
-        adaptiveMedianFilter<7>(img);
-    }
+    ImageSystem::adaptiveMedianFilter<7>(img, 1 << 5);
 
     // Apply adaptive median filter
-    for (int i = 0; i < (1 << 5); ++i) {
-        adaptiveMedianFilter<9>(img);
-    }
+    ImageSystem::adaptiveMedianFilter<9>(img, 1 << 5);
 
     
     // Apply adaptive median filter
-    for (int i = 0; i < (1 << 5); ++i) {
-        adaptiveMedianFilter<11>(img);
-    }
+    ImageSystem::adaptiveMedianFilter<11>(img, 1 << 5);
+
 
 
 
+    // Apply Laplacian filter: img - laplacian(img) in one kernel
+    ImageSystem::convolve(img, Kernel::dense(3, 3, {0, -1, 0, -1, 5, -1, 0, -1, 0}));
 
-    // Apply Laplacian filter
-    applyLaplacianFilter(img);
 
+    // The edits below write img.buf directly
+    ImageSystem::makeWritable(img);
 
     // Define the region of the shirt and the color ranges (based on the histogram analysis)
     std::vector<int> hairRegion = {50, 0, 480, 183}; // Region for the shirt starting from bottom-left
@@ -424,7 +216,7 @@ int main(){
  
 
 
-    // Change color to white in whiteSquaresRegion using multithreading
+    // Change color to white in whiteSquaresRegion on the thread pool
     auto modifyColorWhite = [&](const std::vector<int>& region) {
         for (int y = region[1]; y < region[3]; ++y) {
             for (int x = region[0]; x < region[2]; ++x) {
@@ -437,17 +229,17 @@ int main(){
         }
     };
 
-    std::vector<std::thread> threadsForModifyWhite;
-    threadsForModifyWhite.emplace_back(modifyColorWhite, std::vector<int>{162, 240, 178, 258});
-    threadsForModifyWhite.emplace_back(modifyColorWhite, std::vector<int>{179, 225, 193, 239});
-    threadsForModifyWhite.emplace_back(modifyColorWhite, std::vector<int>{192, 210, 208, 224});
-    threadsForModifyWhite.emplace_back(modifyColorWhite, std::vector<int>{322, 242, 339, 258});
-    threadsForModifyWhite.emplace_back(modifyColorWhite, std::vector<int>{340, 226, 351, 240});
-    threadsForModifyWhite.emplace_back(modifyColorWhite, std::vector<int>{352, 211, 367, 224});
-
-    for (auto& thread : threadsForModifyWhite) {
-        thread.join();
-    }
+    const std::vector<std::vector<int>> regionsForModifyWhite = {
+        {162, 240, 178, 258},
+        {179, 225, 193, 239},
+        {192, 210, 208, 224},
+        {322, 242, 339, 258},
+        {340, 226, 351, 240},
+        {352, 211, 367, 224},
+    };
+    ThreadPool::parallelFor(regionsForModifyWhite.size(), [&](int i, int) {
+        modifyColorWhite(regionsForModifyWhite[i]);
+    });
 
 
 
@@ -469,13 +261,13 @@ int main(){
         }
     };
 
-    std::vector<std::thread> threadsForModifyDiagonal;
-    threadsForModifyDiagonal.emplace_back(modifyColorDiagonal, std::vector<int>{153, 200, 212, 255});
-    threadsForModifyDiagonal.emplace_back(modifyColorDiagonal, std::vector<int>{314,204, 366, 255});
-
-    for (auto& thread : threadsForModifyDiagonal) {
-        thread.join();
-    }
+    const std::vector<std::vector<int>> regionsForModifyDiagonal = {
+        {153, 200, 212, 255},
+        {314,204, 366, 255},
+    };
+    ThreadPool::parallelFor(regionsForModifyDiagonal.size(), [&](int i, int) {
+        modifyColorDiagonal(regionsForModifyDiagonal[i]);
+    });
 
     
 
@@ -504,7 +296,7 @@ int main(){
     uniqueColors.insert(bgColor);
 
 
-        // Change color to red in modifyRegions using multithreading
+        // Change color to red in modifyRegions on the thread pool
     auto modifyColorMustache = [&](const std::vector<int>& region) {
         for (int y = region[1]; y < region[3]; ++y) {
             for (int x = region[0]; x < region[2]; ++x) {
@@ -517,20 +309,18 @@ int main(){
         }
     };
 
-    std::vector<std::thread> threadsForModifyMustache ;
-    threadsForModifyMustache.emplace_back(modifyColorMustache, std::vector<int>{193, 332, 339, 400});
-    threadsForModifyMustache.emplace_back(modifyColorMustache, std::vector<int>{230, 284, 273, 300});
-    threadsForModifyMustache.emplace_back(modifyColorMustache, std::vector<int>{332, 332, 380, 392});
-
-
-
-    for (auto& thread : threadsForModifyMustache ) {
-        thread.join();
-    }
+    const std::vector<std::vector<int>> regionsForModifyMustache = {
+        {193, 332, 339, 400},
+        {230, 284, 273, 300},
+        {332, 332, 380, 392},
+    };
+    ThreadPool::parallelFor(regionsForModifyMustache.size(), [&](int i, int) {
+        modifyColorMustache(regionsForModifyMustache[i]);
+    });
 
 
 
-    // Change color to blue in modifyRegion1 using multithreading
+    // Change color to blue in modifyRegion1 on the thread pool
     auto modifyColorBackground = [&](const std::vector<int>& region) {
         for (int y = region[1]; y < region[3]; ++y) {
             for (int x = region[0]; x < region[2]; ++x) {
@@ -543,12 +333,12 @@ int main(){
         }
     };
 
-    std::vector<std::thread> threadsForModifyBackground;
-    threadsForModifyBackground.emplace_back(modifyColorBackground, std::vector<int>{79, 451, 440, 512});
-
-    for (auto& thread : threadsForModifyBackground) {
-        thread.join();
-    }
+    const std::vector<std::vector<int>> regionsForModifyBackground = {
+        {79, 451, 440, 512},
+    };
+    ThreadPool::parallelFor(regionsForModifyBackground.size(), [&](int i, int) {
+        modifyColorBackground(regionsForModifyBackground[i]);
+    });
 
 
 
@@ -571,52 +361,45 @@ int main(){
     };
 
 
-    std::vector<std::thread> threadsForModifySkin;
-    threadsForModifySkin.emplace_back(modifyColorSkin, std::vector<int>{93, 124, 416, 332});
-    threadsForModifySkin.emplace_back(modifyColorSkin, std::vector<int>{196, 406, 320, 432});
-    threadsForModifySkin.emplace_back(modifyColorSkin, std::vector<int>{200, 416, 302, 437});
-    threadsForModifySkin.emplace_back(modifyColorSkin, std::vector<int>{422, 211, 433, 243});
-
-
-
-
-    for (auto& thread : threadsForModifySkin) {
-        thread.join();
-    }
-
-
-
-
-
-   std::vector<std::thread> threadsForFloodFill;
-    threadsForFloodFill.emplace_back(floodFill, std::ref(img), 124, 376, bgColor, redColor, 50);
-    threadsForFloodFill.emplace_back(floodFill, std::ref(img), 161, 387, bgColor, redColor, 50);
-    threadsForFloodFill.emplace_back(floodFill, std::ref(img), 256, 318, redColor, lightBrownColor, 50);
-    threadsForFloodFill.emplace_back(floodFill, std::ref(img), 407, 358, lightBrownColor, redColor, 10000);
-    threadsForFloodFill.emplace_back(floodFill, std::ref(img), 416, 300, lightBrownColor, redColor, 200);
-    threadsForFloodFill.emplace_back(floodFill, std::ref(img), 245, 443, bgColor, blueColor, 1000);
-    threadsForFloodFill.emplace_back(floodFill, std::ref(img), 280, 442, bgColor, blueColor, 10000);
-    threadsForFloodFill.emplace_back(floodFill, std::ref(img), 307, 435, bgColor, blueColor, 10000);
-    threadsForFloodFill.emplace_back(floodFill, std::ref(img), 320, 432, bgColor, blueColor,20);
-    threadsForFloodFill.emplace_back(floodFill, std::ref(img), 429, 221, bgColor, lightBrownColor,1000);
-    threadsForFloodFill.emplace_back(floodFill, std::ref(img), 427, 204, bgColor, lightBrownColor,50);
-    threadsForFloodFill.emplace_back(floodFill, std::ref(img), 263, 447, bgColor, lightBrownColor,100);
-    threadsForFloodFill.emplace_back(floodFill, std::ref(img), 198, 432, bgColor, lightBrownColor,100);
-    threadsForFloodFill.emplace_back(floodFill, std::ref(img), 96, 325, lightBrownColor, redColor,100);
-    threadsForFloodFill.emplace_back(floodFill, std::ref(img), 417, 201, bgColor ,std::vector<int>{0,0,0},50);
-
-
-
-    for(auto& thread: threadsForFloodFill){
-        thread.join();
-    }
+    const std::vector<std::vector<int>> regionsForModifySkin = {
+        {93, 124, 416, 332},
+        {196, 406, 320, 432},
+        {200, 416, 302, 437},
+        {422, 211, 433, 243},
+    };
+    ThreadPool::parallelFor(regionsForModifySkin.size(), [&](int i, int) {
+        modifyColorSkin(regionsForModifySkin[i]);
+    });
+
+
+
+
+
+    const std::vector<std::function<void()>> fillsForFloodFill = {
+        [&] { floodFill(img, 124, 376, bgColor, redColor, 50); },
+        [&] { floodFill(img, 161, 387, bgColor, redColor, 50); },
+        [&] { floodFill(img, 256, 318, redColor, lightBrownColor, 50); },
+        [&] { floodFill(img, 407, 358, lightBrownColor, redColor, 10000); },
+        [&] { floodFill(img, 416, 300, lightBrownColor, redColor, 200); },
+        [&] { floodFill(img, 245, 443, bgColor, blueColor, 1000); },
+        [&] { floodFill(img, 280, 442, bgColor, blueColor, 10000); },
+        [&] { floodFill(img, 307, 435, bgColor, blueColor, 10000); },
+        [&] { floodFill(img, 320, 432, bgColor, blueColor,20); },
+        [&] { floodFill(img, 429, 221, bgColor, lightBrownColor,1000); },
+        [&] { floodFill(img, 427, 204, bgColor, lightBrownColor,50); },
+        [&] { floodFill(img, 263, 447, bgColor, lightBrownColor,100); },
+        [&] { floodFill(img, 198, 432, bgColor, lightBrownColor,100); },
+        [&] { floodFill(img, 96, 325, lightBrownColor, redColor,100); },
+        [&] { floodFill(img, 417, 201, bgColor ,std::vector<int>{0,0,0},50); },
+    };
+    ThreadPool::parallelFor(fillsForFloodFill.size(), [&](int i, int) {
+        fillsForFloodFill[i]();
+    });
 
 
 
 
-    for(size_t i=0 ;i < (1<<6);++i){
-        modifyPixels<3>(img);
-    }
+    modifyPixels<3>(img, 1 << 6);
 
 
 
@@ -8,6 +8,34 @@
 
 struct Fd;
 
+// How filters extend the image past its edges: Clamp repeats the edge
+// pixel, Mirror reflects about it (without repeating it), Wrap tiles
+enum class BorderMode {
+    Clamp,
+    Mirror,
+    Wrap
+};
+
+// Pixels of one image state. An image's current buffer, its original and
+// its undo snapshots share these by reference count instead of copying.
+using PixelBuffer = std::shared_ptr<uint8_t[]>;
+
+struct Snapshot {
+    PixelBuffer pixels;
+    uint32_t width;
+    uint32_t height;
+    uint32_t bitDepth;
+};
+
+// buf and original point into pixels and originalPixels, which own them;
+// a new buffer is installed with ImageSystem::setPixels, never by
+// assigning buf. While pixels is shared, buf must not be written:
+// ImageSystem operations detach it first, and code writing buf directly
+// calls ImageSystem::makeWritable.
+//
+// bitDepth is 24 (BGR) or 8 (gray, colorTable the gray ramp); readImage
+// converts every other BMP layout to one of them. Operations without an
+// 8-bit kernel promote a gray image to 24-bit first.
 struct Image {
     uint32_t width;
     uint32_t height;
@@ -19,7 +47,72 @@ struct Image {
 
     uint32_t originalWidth;
     uint32_t originalHeight;
+    uint32_t originalBitDepth;
+
+    PixelBuffer pixels;
+    PixelBuffer originalPixels;
+    // Oldest first, at most UNDO_DEPTH entries
+    std::vector<Snapshot> undoStack;
+};
+
+// One filter pass: reads src and writes every sample of dst, a buffer the
+// size of src.buf
+using FilterPass = std::function<void(const Image& src, uint8_t* dst)>;
 
+// Buffers a filter keeps across the passes of ImageSystem::iterate
+struct FilterWorkspace {
+    std::vector<uint8_t> planes;
+    std::vector<uint8_t> padded;
+    std::vector<int32_t> accumulators;
+};
+
+// Convolution weights, row-major height x width with odd sides; weights[0]
+// meets the neighbour at (-width / 2, -height / 2). A rank-1 kernel also
+// keeps the column and row factors it splits into, and ImageSystem::convolve
+// then runs it as two 1-D passes. dense() finds the factors itself.
+struct Kernel {
+    int width;
+    int height;
+    std::vector<float> weights;
+    std::vector<float> columnWeights;
+    std::vector<float> rowWeights;
+
+    [[nodiscard]] bool isSeparable() const noexcept { return !rowWeights.empty(); }
+
+    [[nodiscard]] static Kernel dense(int width, int height, std::vector<float> weights) noexcept;
+    [[nodiscard]] static Kernel fromFactors(std::vector<float> column, std::vector<float> row) noexcept;
+
+    [[nodiscard]] static Kernel box(int size) noexcept;
+    [[nodiscard]] static Kernel gaussian(int size, float sigma) noexcept;
+    [[nodiscard]] static Kernel laplacian() noexcept;
+    [[nodiscard]] static Kernel sobelX() noexcept;
+    [[nodiscard]] static Kernel sobelY() noexcept;
+};
+
+// A chain of per-channel point operations folded into one 256-entry table
+// per channel, in buffer order. Each step maps the tables built so far, so
+// a chain of any length costs one pass of ImageSystem::applyPointOps.
+struct PointOps {
+    std::array<std::array<uint8_t, 256>, 3> tables;
+
+    PointOps() noexcept;
+
+    PointOps& brightness(int amount) noexcept;
+    PointOps& contrast(int amount) noexcept;
+    PointOps& gamma(float gamma) noexcept;
+    PointOps& invert() noexcept;
+    PointOps& temperature(int channel0, int channel1, int channel2) noexcept;
+    // Any per-channel map; results are clamped to 0..255
+    PointOps& map(const std::function<int(int value, int channel)>& f) noexcept;
+};
+
+// One operation of ImageSystem::processStream, run in place on a band of
+// whole rows. `halo` is how many rows above and below a written row the
+// operation reads: 0 for point operations, size / 2 for a size x size
+// window. It must keep the band's size.
+struct StreamStage {
+    int halo;
+    std::function<void(Image& band)> apply;
 };
 
 struct ImageSystem {
@@ -32,7 +125,22 @@ struct ImageSystem {
     static void convertToGreen(Image& img) noexcept;
     static void convertToBlue(Image& img) noexcept;
     static void convertToGrayscale(Image& img) noexcept;
+    // Gray of every pixel as one byte, into plane (width * height bytes)
+    static void convertToGrayscale(const Image& img, uint8_t* plane) noexcept;
+    // Turns img into an 8-bit gray image, so later operations touch one
+    // byte per pixel instead of three
+    static void convertToGray8(Image& img) noexcept;
+    // O(1): the image shares its original's pixels again
     static void restoreToOriginal(Image& img) noexcept;
+    // Makes pixels the image's buffer; the old one goes when its last
+    // owner does
+    static void setPixels(Image& img, PixelBuffer pixels) noexcept;
+    // Copies buf if a snapshot or the original shares it
+    static void makeWritable(Image& img) noexcept;
+    // Saves the current state without copying it; undo() brings back the
+    // most recent one, and returns false when there is none
+    static void pushUndo(Image& img) noexcept;
+    static bool undo(Image& img) noexcept;
 
     [[nodiscard]] static int getRGB(const Image& img, int x, int y) noexcept;
     static void setRGB(Image& img, int x, int y, int color) noexcept;
@@ -55,11 +163,42 @@ struct ImageSystem {
     template<int rTemp, int gTemp, int bTemp>
     static void setTemperature(Image& img) noexcept;
 
+    // One pass over the image through the tables of ops; the single point
+    // operations above are one-step chains
+    static void applyPointOps(Image& img, const PointOps& ops) noexcept;
+
     template<int size>
-    static void averagingFilter(Image& img) noexcept;
+    static void averagingFilter(Image& img, BorderMode border = BorderMode::Clamp) noexcept;
+    [[nodiscard]] static int borderIndex(int i, int n, BorderMode border) noexcept;
 
     template<int size>
-    static void medianFilter(Image& img) noexcept;
+    static void medianFilter(Image& img, BorderMode border = BorderMode::Clamp) noexcept;
+    // Adaptive median: each pixel's window grows from 3x3 up to
+    // maxWindowSize until its median is not an extreme of the window; the
+    // pixel is then kept unless it is an extreme itself. Runs up to
+    // `iterations` passes through iterate() and returns how many ran.
+    template<int maxWindowSize>
+    static int adaptiveMedianFilter(Image& img, int iterations = 1, BorderMode border = BorderMode::Clamp) noexcept;
+    template<int maxWindowSize>
+    static void adaptiveMedianPass(const Image& img, uint8_t* output, BorderMode border, FilterWorkspace& workspace) noexcept;
+    // Median, minimum and maximum of every channel sample's size x size
+    // window, written as interleaved planes like img.buf; minimum and
+    // maximum may be null. Only sizes with a MedianNetwork (3 and 5).
+    // padded, when given, holds the bordered copy between calls.
+    template<int size>
+    static void windowStatistics(const Image& img, BorderMode border, uint8_t* median, uint8_t* minimum, uint8_t* maximum, std::vector<uint8_t>* padded = nullptr) noexcept;
+
+    // Runs pass up to `iterations` times, alternating between img.buf and
+    // one scratch buffer, so passes neither allocate output nor copy it
+    // back. With stopWhenStable it stops after the first pass that changes
+    // no sample. Returns the number of passes run.
+    static int iterate(Image& img, int iterations, const FilterPass& pass, bool stopWhenStable = true) noexcept;
+
+    // Correlates every channel with kernel, adds offset and saturates to
+    // 0..255. Weights are run as fixed point, which is exact for integer
+    // and dyadic weights and otherwise within one level of the float sum.
+    static void convolve(Image& img, const Kernel& kernel, BorderMode border = BorderMode::Clamp, int offset = 0) noexcept;
+    static void convolvePass(const Image& img, uint8_t* output, const Kernel& kernel, BorderMode border, int offset, FilterWorkspace& workspace) noexcept;
 
     template<int k, int size>
     static void unsharpMasking(Image& img) noexcept;
@@ -71,13 +210,19 @@ struct ImageSystem {
     static void addPepperNoise(Image& img) noexcept;
 
     template<int size>
-    static void contraharmonicFilter(Image& img,double Q) noexcept;
+    static void contraharmonicFilter(Image& img,double Q, BorderMode border = BorderMode::Clamp) noexcept;
 
     static void addUniformNoise(Image& img, double percent=10.f, int distribution=64)noexcept;
 
 
     //Sampling lab
     static bool write(Image &img, std::string_view fileName) noexcept;
+    // Runs stages over the BMP at source a band of rows at a time and
+    // writes the result to dest, holding only a band plus the stages'
+    // halos in memory; bandRows = 0 sizes bands to STREAM_BAND_BYTES.
+    // Bands meet the image's own top and bottom edges, so Clamp and Mirror
+    // borders match a whole-image run; vertical Wrap does not.
+    static bool processStream(std::string_view source, std::string_view dest, const std::vector<StreamStage>& stages, int bandRows = 0) noexcept;
     static void ResizeNearestNeighbor(Image& img, int newWidth, int newHeight) noexcept;
     static void ResizeBilinear(Image& img, double scaleX, double scaleY) noexcept;
 
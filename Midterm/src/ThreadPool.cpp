@@ -0,0 +1,224 @@
+#include "pch.h"
+#include "ThreadPool.h"
+
+// Pixel bytes a tile aims for: the tile, its halo and its output stay in
+// a typical 256 KB L2
+#define THREAD_POOL_TILE_BYTES (96 * 1024)
+// Tiles narrower than this are not split further across columns
+#define THREAD_POOL_MIN_TILE_WIDTH 64
+// Tiles a tiling aims to give each thread, so stealing has work to move
+#define THREAD_POOL_TASKS_PER_THREAD 4
+// A tile is kept at least this many halos tall when the image allows
+#define THREAD_POOL_HALO_RATIO 4
+
+// One parallelFor call. The caller waits on `finished` until every task
+// has run; remaining only changes under `mutex`, so the caller cannot
+// return while the last task still touches the batch.
+struct Batch {
+    const std::function<void(int, int)>* task;
+    int remaining;
+    std::mutex mutex;
+    std::condition_variable finished;
+};
+
+struct Job {
+    Batch* batch;
+    int index;
+};
+
+struct WorkerQueue {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+};
+
+struct PoolState {
+    int size;
+    // One queue per thread; queue 0 belongs to callers outside the pool
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> threads;
+
+    // Idle workers sleep on wake until jobs are queued
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::atomic<int> pending = 0;
+    bool stopping = false;
+
+    ~PoolState() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : threads) {
+            t.join();
+        }
+    }
+};
+
+// Callers outside the pool hold a reference for the length of their batch,
+// so setThreadCount can drop the pool while batches still run on it; the
+// last batch to finish joins its threads. A pool thread never holds one:
+// its own pool cannot be destroyed before it returns, and dropping the
+// last reference there would make the pool join itself.
+static std::mutex poolMutex;
+static std::shared_ptr<PoolState> pool;
+static std::atomic<int> threadCount = 0;
+static thread_local PoolState* currentPool = nullptr;
+static thread_local int currentWorker = 0;
+
+// Own queue from the front, other queues from the back. With `only` set,
+// takes only that batch's jobs, so a waiting caller never runs another
+// batch's task under a worker index that batch already uses.
+static bool takeJob(PoolState& state, int worker, const Batch* only, Job& job) noexcept {
+    for (int k = 0; k < state.size; ++k) {
+        WorkerQueue& queue = *state.queues[(worker + k) % state.size];
+        std::lock_guard lock(queue.mutex);
+        if (queue.jobs.empty()) {
+            continue;
+        }
+        if (only) {
+            auto it = std::find_if(queue.jobs.begin(), queue.jobs.end(), [&](const Job& j) { return j.batch == only; });
+            if (it == queue.jobs.end()) {
+                continue;
+            }
+            job = *it;
+            queue.jobs.erase(it);
+        } else if (k == 0) {
+            job = queue.jobs.front();
+            queue.jobs.pop_front();
+        } else {
+            job = queue.jobs.back();
+            queue.jobs.pop_back();
+        }
+        --state.pending;
+        return true;
+    }
+    return false;
+}
+
+static void runJob(const Job& job, int worker) noexcept {
+    (*job.batch->task)(job.index, worker);
+    std::lock_guard lock(job.batch->mutex);
+    if (--job.batch->remaining == 0) {
+        job.batch->finished.notify_all();
+    }
+}
+
+static void workerLoop(PoolState& state, int worker) noexcept {
+    currentPool = &state;
+    currentWorker = worker;
+    while (true) {
+        Job job;
+        if (takeJob(state, worker, nullptr, job)) {
+            runJob(job, worker);
+            continue;
+        }
+        std::unique_lock lock(state.mutex);
+        state.wake.wait(lock, [&] { return state.stopping || state.pending > 0; });
+        if (state.stopping) {
+            return;
+        }
+    }
+}
+
+static std::shared_ptr<PoolState> getPool() noexcept {
+    std::lock_guard lock(poolMutex);
+    if (!pool) {
+        pool = std::make_shared<PoolState>();
+        pool->size = ThreadPool::getThreadCount();
+        for (int i = 0; i < pool->size; ++i) {
+            pool->queues.push_back(std::make_unique<WorkerQueue>());
+        }
+        for (int i = 1; i < pool->size; ++i) {
+            pool->threads.emplace_back(workerLoop, std::ref(*pool), i);
+        }
+    }
+    return pool;
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int index, int worker)>& task) noexcept {
+    if (count <= 0) {
+        return;
+    }
+    // Nested batches stay on the pool of the worker that starts them
+    std::shared_ptr<PoolState> owner;
+    if (!currentPool) {
+        owner = getPool();
+    }
+    PoolState& state = currentPool ? *currentPool : *owner;
+    if (state.size == 1 || count == 1) {
+        for (int i = 0; i < count; ++i) {
+            task(i, currentWorker);
+        }
+        return;
+    }
+
+    // Contiguous runs of tasks per queue, so neighbouring tiles start on
+    // the same thread
+    Batch batch{&task, count, {}, {}};
+    for (int q = 0; q < state.size; ++q) {
+        WorkerQueue& queue = *state.queues[(currentWorker + q) % state.size];
+        std::lock_guard lock(queue.mutex);
+        for (int i = q * count / state.size; i < (q + 1) * count / state.size; ++i) {
+            queue.jobs.push_back({&batch, i});
+        }
+    }
+    {
+        std::lock_guard lock(state.mutex);
+        state.pending += count;
+    }
+    state.wake.notify_all();
+
+    Job job;
+    while (takeJob(state, currentWorker, &batch, job)) {
+        runJob(job, currentWorker);
+    }
+    std::unique_lock lock(batch.mutex);
+    batch.finished.wait(lock, [&] { return batch.remaining == 0; });
+}
+
+void ThreadPool::parallelForTiles(int width, int height, int halo, int bytesPerPixel, const std::function<void(const Tile& tile, int worker)>& task) noexcept {
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+    const int minHeight = std::max(1, THREAD_POOL_HALO_RATIO * halo);
+
+    // Whole rows unless a row of minimum-height tiles overflows the budget
+    int tileWidth = width;
+    if (static_cast<int64_t>(width) * bytesPerPixel * minHeight > THREAD_POOL_TILE_BYTES) {
+        tileWidth = std::max(THREAD_POOL_MIN_TILE_WIDTH, THREAD_POOL_TILE_BYTES / (bytesPerPixel * minHeight));
+        tileWidth = std::min(width, tileWidth / 16 * 16);
+    }
+    const int across = (width + tileWidth - 1) / tileWidth;
+
+    // As tall as the budget allows, but short enough to give every thread
+    // a few tiles, and never shorter than two halos unless the image is
+    const int bands = (THREAD_POOL_TASKS_PER_THREAD * getThreadCount() + across - 1) / across;
+    int tileHeight = std::max(1, THREAD_POOL_TILE_BYTES / (tileWidth * bytesPerPixel));
+    tileHeight = std::min(tileHeight, (height + bands - 1) / bands);
+    tileHeight = std::min(std::max(tileHeight, std::max(1, 2 * halo)), height);
+    const int down = (height + tileHeight - 1) / tileHeight;
+
+    parallelFor(across * down, [&](int index, int worker) {
+        const int x0 = index % across * tileWidth;
+        const int y0 = index / across * tileHeight;
+        task(Tile{x0, y0, std::min(width, x0 + tileWidth), std::min(height, y0 + tileHeight)}, worker);
+    });
+}
+
+void ThreadPool::setThreadCount(int count) noexcept {
+    std::shared_ptr<PoolState> retired;
+    {
+        std::lock_guard lock(poolMutex);
+        threadCount = std::max(0, count);
+        retired = std::move(pool);
+    }
+}
+
+int ThreadPool::getThreadCount() noexcept {
+    const int count = threadCount;
+    if (count > 0) {
+        return count;
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
@@ -0,0 +1,37 @@
+#ifndef __THREAD_POOL__
+#define __THREAD_POOL__
+
+
+// Output rectangle [x0, x1) x [y0, y1) of one tile, in pixels
+struct Tile {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+};
+
+// Persistent worker threads shared by every ImageSystem operation, started
+// on first use. Each worker owns a queue of tasks and steals from the
+// others' when it runs dry, so uneven tasks (image edges, pixels that need
+// large windows) even out. A caller waits for its batch by running its
+// own tasks, so batches can nest.
+//
+// Tasks get a worker index in [0, getThreadCount()) that no other thread
+// uses for the same batch, to pick per-thread scratch.
+struct ThreadPool {
+    static void parallelFor(int count, const std::function<void(int index, int worker)>& task) noexcept;
+
+    // Splits a width x height image of bytesPerPixel pixels into tiles of
+    // about THREAD_POOL_TILE_BYTES. A tile reading `halo` pixels around
+    // itself is kept several halos tall, so re-read borders stay cheap.
+    static void parallelForTiles(int width, int height, int halo, int bytesPerPixel, const std::function<void(const Tile& tile, int worker)>& task) noexcept;
+
+    // Threads including the caller; 0 means one per hardware thread.
+    // Changing it restarts the workers; batches already running finish on
+    // the old ones. Per-worker scratch sized from getThreadCount() is only
+    // valid if the count does not change during the operation that sized it.
+    static void setThreadCount(int count) noexcept;
+    [[nodiscard]] static int getThreadCount() noexcept;
+};
+
+#endif // __THREAD_POOL__
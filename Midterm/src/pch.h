@@ -21,7 +21,12 @@
 #include<thread>
 #include <mutex>
 #include <cstdint>
+#include <array>
 #include <iterator>
 #include<functional>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <memory>
 
 #endif // PCH_H
\ No newline at end of file